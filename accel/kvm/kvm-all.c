@@ -36,6 +36,7 @@
 #include "exec/ram_addr.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/stats64.h"
 #include "trace.h"
 #include "hw/irq.h"
 #include "qapi/visitor.h"
@@ -621,9 +622,13 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces.  @atomic is
+ * true when other threads may be marking pages at the same time.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
-                                     uint32_t slot_id, uint64_t offset)
+                                     uint32_t slot_id, uint64_t offset,
+                                     bool atomic)
 {
     KVMMemoryListener *kml;
     KVMSlot *mem;
@@ -640,7 +645,11 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (atomic) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    } else {
+        set_bit(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -677,7 +686,8 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
  * Should be with all slots_lock held for the address spaces.  It returns the
  * dirty page we've collected on this dirty ring.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        bool atomic)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
@@ -692,7 +702,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
             break;
         }
         kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+                                 cur->offset, atomic);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
@@ -704,6 +714,44 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+typedef struct {
+    KVMState *s;
+    CPUState **cpus;
+    Stat64 total;
+} KVMDirtyRingReapWork;
+
+static void kvm_dirty_ring_reap_work(void *opaque, unsigned int index)
+{
+    KVMDirtyRingReapWork *work = opaque;
+
+    stat64_add(&work->total,
+               kvm_dirty_ring_reap_one(work->s, work->cpus[index], true));
+}
+
+/* Reap all the vcpu rings, spread over the reaper pool threads */
+static uint64_t kvm_dirty_ring_reap_all_parallel(KVMState *s)
+{
+    KVMDirtyRingReapWork work = { .s = s };
+    unsigned int nr_cpus = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+
+    work.cpus = g_new(CPUState *, nr_cpus);
+    nr_cpus = 0;
+    CPU_FOREACH(cpu) {
+        work.cpus[nr_cpus++] = cpu;
+    }
+
+    work_pool_run(s->kvm_dirty_ring_reap_pool, kvm_dirty_ring_reap_work,
+                  &work, nr_cpus);
+    g_free(work.cpus);
+
+    return stat64_get(&work.total);
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -714,10 +762,12 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = kvm_dirty_ring_reap_one(s, cpu, false);
+    } else if (s->kvm_dirty_ring_reap_pool) {
+        total = kvm_dirty_ring_reap_all_parallel(s);
     } else {
         CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
+            total += kvm_dirty_ring_reap_one(s, cpu, false);
         }
     }
 
@@ -2598,6 +2648,10 @@ static int kvm_init(MachineState *ms)
     }
 
     if (s->kvm_dirty_ring_size) {
+        if (s->kvm_dirty_ring_reap_threads) {
+            s->kvm_dirty_ring_reap_pool =
+                work_pool_new("kvm-ring-reap", s->kvm_dirty_ring_reap_threads);
+        }
         ret = kvm_dirty_ring_reaper_init(s);
         if (ret) {
             goto err;
@@ -3604,6 +3658,35 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reap_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->kvm_dirty_ring_reap_threads = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3657,6 +3740,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reap-threads", "uint32",
+        kvm_get_dirty_ring_reap_threads, kvm_set_dirty_ring_reap_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reap-threads",
+        "Threads that help reaping the vcpu dirty rings (default: 0)");
+
     kvm_arch_accel_class_init(oc);
 }
 
@@ -243,6 +243,8 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+unsigned int tb_jmp_cache_max_bits = TB_JMP_CACHE_DEFAULT_MAX_BITS;
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
@@ -255,8 +257,8 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(pc);
     jc = cpu->tb_jmp_cache;
+    hash = tb_jmp_cache_hash_func(pc, jc->bits);
     tb = tb_jmp_cache_get_tb(jc, hash);
 
     if (likely(tb &&
@@ -265,8 +267,10 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                tb->flags == flags &&
                tb->trace_vcpu_dstate == *cpu->trace_dstate &&
                tb_cflags(tb) == cflags)) {
+        qatomic_set(&jc->hits, jc->hits + 1);
         return tb;
     }
+    qatomic_set(&jc->misses, jc->misses + 1);
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return NULL;
@@ -390,6 +394,7 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
 {
     CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
+    CPUJumpCache *jc;
     target_ulong cs_base, pc;
     uint32_t flags, cflags;
 
@@ -400,6 +405,9 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
         cpu_loop_exit(cpu);
     }
 
+    jc = cpu->tb_jmp_cache;
+    qatomic_set(&jc->helper_lookups, jc->helper_lookups + 1);
+
     tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
         return tcg_code_gen_epilogue;
@@ -412,6 +420,46 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+/**
+ * helper_tb_check_page1: check the second page of a TB on entry
+ * @env: current cpu state
+ * @tb_ptr: the TB being entered, which spans two pages
+ *
+ * Nothing unlinks the direct jumps into a TB when the mapping of its
+ * second page changes.  However, any TLB flush covering either of its
+ * pages also drops the TB from the vCPU's jump cache, so as long as the
+ * TB is still found there, the page was translated the same way as when
+ * the TB was last looked up.  Otherwise, return to the main loop so that
+ * a full lookup is done.
+ */
+void HELPER(tb_check_page1)(CPUArchState *env, void *tb_ptr)
+{
+    CPUState *cpu = env_cpu(env);
+    TranslationBlock *tb = tb_ptr;
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    target_ulong pc;
+    uint32_t hash;
+
+    if (TARGET_TB_PCREL) {
+        target_ulong cs_base;
+        uint32_t flags;
+
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    } else {
+        pc = tb_pc(tb);
+    }
+
+    hash = tb_jmp_cache_hash_func(pc, jc->bits);
+    if (likely(tb_jmp_cache_get_tb(jc, hash) == tb &&
+               tb_jmp_cache_get_pc(jc, hash, tb) == pc)) {
+        return;
+    }
+
+    qatomic_set(&jc->page1_check_fails, jc->page1_check_fails + 1);
+    cpu_restore_state_from_tb(cpu, tb, GETPC());
+    cpu_loop_exit_noexc(cpu);
+}
+
 /* Execute a TB, and fix up the CPU state afterwards if necessary */
 /*
  * Disable CFI checks.
@@ -583,7 +631,8 @@ void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
     }
 }
 
-static inline void tb_add_jump(TranslationBlock *tb, int n,
+/* Returns true if the jump was patched by this call */
+static inline bool tb_add_jump(TranslationBlock *tb, int n,
                                TranslationBlock *tb_next)
 {
     uintptr_t old;
@@ -604,7 +653,8 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     }
 
     /* patch the native jump address */
-    tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc.ptr);
+    tb_set_jmp_target(tb, n,
+                      (uintptr_t)tb_next->tc.ptr + tb_next->jmp_entry_offset);
 
     /* add in TB jmp list */
     tb->jmp_list_next[n] = tb_next->jmp_list_head;
@@ -614,11 +664,11 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 
     qemu_log_mask(CPU_LOG_EXEC, "Linking TBs %p index %d -> %p\n",
                   tb->tc.ptr, n, tb_next->tc.ptr);
-    return;
+    return true;
 
  out_unlock_next:
     qemu_spin_unlock(&tb_next->jmp_lock);
-    return;
+    return false;
 }
 
 static inline bool cpu_handle_halt(CPUState *cpu)
@@ -975,6 +1025,7 @@ int cpu_exec(CPUState *cpu)
 
         while (!cpu_handle_interrupt(cpu, &last_tb)) {
             TranslationBlock *tb;
+            CPUJumpCache *jc;
             target_ulong cs_base, pc;
             uint32_t flags, cflags;
 
@@ -998,6 +1049,9 @@ int cpu_exec(CPUState *cpu)
                 break;
             }
 
+            jc = cpu->tb_jmp_cache;
+            qatomic_set(&jc->loop_lookups, jc->loop_lookups + 1);
+
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
             if (tb == NULL) {
                 uint32_t h;
@@ -1009,24 +1063,31 @@ int cpu_exec(CPUState *cpu)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(pc);
+                h = tb_jmp_cache_hash_func(pc, cpu->tb_jmp_cache->bits);
                 tb_jmp_cache_set(cpu->tb_jmp_cache, h, tb, pc);
             }
 
-#ifndef CONFIG_USER_ONLY
             /*
-             * We don't take care of direct jumps when address mapping
-             * changes in system emulation.  So it's not safe to make a
-             * direct jump to a TB spanning two pages because the mapping
-             * for the second page can change.
+             * One-shot TBs are not in the region trees, so nothing would
+             * unlink jumps to or from them when their region is recycled.
              */
-            if (tb_page_addr1(tb) != -1) {
+            if (tb_page_addr0(tb) == -1 ||
+                (last_tb && tb_page_addr0(last_tb) == -1)) {
                 last_tb = NULL;
             }
-#endif
-            /* See if we can patch the calling TB. */
-            if (last_tb) {
-                tb_add_jump(last_tb, tb_exit, tb);
+            /*
+             * See if we can patch the calling TB.  In system emulation,
+             * direct jumps are not unlinked when the address mapping
+             * changes, so a TB spanning two pages checks its second page
+             * when entered; see helper_tb_check_page1.
+             */
+            if (last_tb && tb_add_jump(last_tb, tb_exit, tb)) {
+                jc = cpu->tb_jmp_cache;
+                qatomic_set(&jc->jmp_links, jc->jmp_links + 1);
+                if (tb_page_addr1(tb) != -1) {
+                    qatomic_set(&jc->jmp_links_cross_page,
+                                jc->jmp_links_cross_page + 1);
+                }
             }
 
             cpu_loop_exec_tb(cpu, tb, pc, &last_tb, &tb_exit);
@@ -1053,7 +1114,7 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
     }
 
-    cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    cpu->tb_jmp_cache = tb_jmp_cache_new(tb_jmp_cache_initial_bits());
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
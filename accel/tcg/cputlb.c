@@ -100,14 +100,91 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
-    int i, i0 = tb_jmp_cache_hash_page(page_addr);
     CPUJumpCache *jc = cpu->tb_jmp_cache;
+    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr, jc->bits);
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    for (i = 0; i < tb_jmp_page_size(jc->bits); i++) {
         qatomic_set(&jc->array[i0 + i].tb, NULL);
     }
 }
 
+/**
+ * tb_jmp_cache_flush_resize() - flush the jump cache; resize if necessary
+ * @cpu: the vCPU owning the cache
+ * @now: current time in ns
+ *
+ * Follows the same policy as tlb_mmu_resize_locked() below: the use rate
+ * of a direct-mapped cache is a good proxy for its conflict miss rate, so
+ * grow aggressively when more than 70% of the entries were used since the
+ * previous flush, and shrink to fit when the maximum use rate seen in a
+ * time window stayed below 30%.
+ *
+ * Only the owning vCPU may replace its cache; other threads find it
+ * through RCU.
+ */
+static void tb_jmp_cache_flush_resize(CPUState *cpu, int64_t now)
+{
+    CPUJumpCache *jc = cpu->tb_jmp_cache, *new_jc;
+    size_t old_size, n_used = 0, rate;
+    unsigned int new_bits;
+    int64_t window_len_ns = 100 * 1000 * 1000;
+    bool window_expired;
+
+    if (unlikely(jc == NULL)) {
+        return;
+    }
+
+    old_size = (size_t)1 << jc->bits;
+    for (size_t i = 0; i < old_size; i++) {
+        if (qatomic_read(&jc->array[i].tb)) {
+            qatomic_set(&jc->array[i].tb, NULL);
+            n_used++;
+        }
+    }
+
+    window_expired = now > jc->window_begin_ns + window_len_ns;
+    if (n_used > jc->window_max_entries) {
+        jc->window_max_entries = n_used;
+    }
+    rate = jc->window_max_entries * 100 / old_size;
+
+    new_bits = jc->bits;
+    if (rate > 70) {
+        new_bits = MIN(jc->bits + 1, tb_jmp_cache_max_bits);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(jc->window_max_entries);
+
+        /* See tlb_mmu_resize_locked() for why the ceiling is doubled */
+        if (jc->window_max_entries * 100 / ceil > 70) {
+            ceil *= 2;
+        }
+        new_bits = MAX(ctz64(ceil), TB_JMP_CACHE_MIN_BITS);
+        new_bits = MIN(new_bits, jc->bits);
+    }
+
+    if (new_bits == jc->bits) {
+        if (window_expired) {
+            jc->window_begin_ns = now;
+            jc->window_max_entries = n_used;
+        }
+        return;
+    }
+
+    new_jc = tb_jmp_cache_new(new_bits);
+    new_jc->hits = jc->hits;
+    new_jc->misses = jc->misses;
+    new_jc->helper_lookups = jc->helper_lookups;
+    new_jc->loop_lookups = jc->loop_lookups;
+    new_jc->jmp_links = jc->jmp_links;
+    new_jc->jmp_links_cross_page = jc->jmp_links_cross_page;
+    new_jc->page1_check_fails = jc->page1_check_fails;
+    new_jc->window_begin_ns = now;
+    new_jc->window_max_entries = 0;
+
+    qatomic_rcu_set(&cpu->tb_jmp_cache, new_jc);
+    g_free_rcu(jc, rcu);
+}
+
 /**
  * tlb_mmu_resize_locked() - perform TLB resize bookkeeping; resize if necessary
  * @desc: The CPUTLBDesc portion of the TLB
@@ -357,7 +434,7 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
-    tcg_flush_jmp_cache(cpu);
+    tb_jmp_cache_flush_resize(cpu, now);
 
     if (to_clean == ALL_MMUIDX_BITS) {
         qatomic_set(&env_tlb(env)->c.full_flush_count,
@@ -785,7 +862,7 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
      */
-    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+    if (d.len >= ((uint64_t)TARGET_PAGE_SIZE << cpu->tb_jmp_cache->bits)) {
         tcg_flush_jmp_cache(cpu);
         return;
     }
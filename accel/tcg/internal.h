@@ -48,12 +48,29 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
+void tb_flush_partial(CPUState *cpu);
+G_NORETURN void tb_hot_retranslate(CPUState *cpu, TranslationBlock *tb,
+                                   uintptr_t retaddr);
 TranslationBlock *tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                                tb_page_addr_t phys_page2);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                uintptr_t host_pc);
 
+extern unsigned int tb_hot_threshold;
+extern int32_t *tb_hot_counts;
+
+/*
+ * Executions left before @tb is retranslated as a trace, decremented by
+ * the generated code without atomics; see tb_hot_retranslate().  This is
+ * not a field of the TB: the TB sits right before its host code, and the
+ * host CPU would take stores to it for self-modifying code.
+ */
+static inline int32_t *tb_hot_count(const TranslationBlock *tb)
+{
+    return &tb_hot_counts[tcg_tb_index(tb)];
+}
+
 /* Return the current PC from CPU, which may be cached in TB. */
 static inline target_ulong log_pc(CPUState *cpu, const TranslationBlock *tb)
 {
@@ -124,20 +124,13 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Inline ops depend on the operation and on whether the target is
+ * per-vCPU, so rather than copying a template we only leave a marker
+ * here; plugin_gen_inject() emits the ops in place of it through
+ * tcg_ctx->emit_before_op.
  */
 static void gen_empty_inline_cb(void)
 {
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -328,19 +321,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -354,21 +334,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -432,25 +397,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -530,16 +476,152 @@ static void inject_cb_type(const GArray *cbs, TCGOp *begin_op,
     rm_ops_range(begin_op, end_op);
 }
 
+static bool op_always(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
+{
+    return cb->cond.cond == QEMU_PLUGIN_COND_ALWAYS;
+}
+
+/* Pointer to the element of @entry belonging to the running vCPU */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry)
+{
+    GArray *data = entry.score->data;
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, g_array_get_element_size(data));
+    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    tcg_temp_free_i32(cpu_index);
+
+    /* scoreboards are only resized along with a tb_flush() */
+    tcg_gen_addi_ptr(ptr, ptr, (intptr_t)(data->data + entry.offset));
+    return ptr;
+}
+
+static TCGv_ptr gen_inline_target(const struct qemu_plugin_dyn_cb *cb)
+{
+    if (cb->inline_insn.entry.score) {
+        return gen_plugin_u64_ptr(cb->inline_insn.entry);
+    }
+    return tcg_constant_ptr(cb->userp);
+}
+
+static void gen_inline_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_inline_target(cb);
+    TCGv_i64 val = tcg_temp_new_i64();
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_movi_i64(val, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_gen_st_i64(val, ptr, 0);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* NEVER and ALWAYS are dealt with at registration/injection time */
+        g_assert_not_reached();
+    }
+}
+
+static void gen_cond_udata_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGLabel *skip = gen_new_label();
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry);
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+    TCGOp *call;
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->cond.imm, skip);
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, tcg_constant_ptr(cb->userp));
+
+    /* redirect the stub helper call to the plugin, as copy_call() does */
+    call = QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    tcg_debug_assert(call->opc == INDEX_op_call);
+    call->args[TCGOP_CALLO(call) + TCGOP_CALLI(call)] =
+        (uintptr_t)cb->f.vcpu_udata;
+
+    gen_set_label(skip);
+
+    tcg_temp_free_i32(cpu_index);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
 static void
 inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
 {
-    inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
+    int i;
+
+    if (!cbs || cbs->len == 0) {
+        rm_ops(begin_op);
+        return;
+    }
+
+    /* conditional callbacks are emitted ahead of the unconditional ones */
+    tcg_ctx->emit_before_op = begin_op;
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (!op_always(begin_op, cb)) {
+            gen_cond_udata_cb(cb);
+        }
+    }
+    tcg_ctx->emit_before_op = NULL;
+
+    inject_cb_type(cbs, begin_op, append_udata_cb, op_always);
 }
 
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    int i;
+
+    if (cbs) {
+        tcg_ctx->emit_before_op = begin_op;
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (ok(begin_op, cb)) {
+                gen_inline_cb(cb);
+            }
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
+    rm_ops(begin_op);
 }
 
 static void
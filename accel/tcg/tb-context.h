@@ -34,6 +34,8 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_partial_flush_count;
+    unsigned tb_trace_count;
     unsigned tb_phys_invalidate_count;
 };
 
@@ -27,35 +27,51 @@
 
 #ifdef CONFIG_SOFTMMU
 
-/* Only the bottom TB_JMP_PAGE_BITS of the jump cache hash bits vary for
-   addresses on the same page.  The top bits are the same.  This allows
-   TLB invalidation to quickly clear a subset of the hash table.  */
-#define TB_JMP_PAGE_BITS (TB_JMP_CACHE_BITS / 2)
-#define TB_JMP_PAGE_SIZE (1 << TB_JMP_PAGE_BITS)
-#define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
-#define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
+/*
+ * Only the bottom tb_jmp_page_bits() of the jump cache hash bits vary for
+ * addresses on the same page.  The top bits are the same.  This allows
+ * TLB invalidation to quickly clear a subset of the hash table.
+ */
+static inline unsigned int tb_jmp_page_bits(unsigned int bits)
+{
+    return bits / 2;
+}
 
-static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
+static inline unsigned int tb_jmp_page_size(unsigned int bits)
 {
+    return 1u << tb_jmp_page_bits(bits);
+}
+
+static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc,
+                                                  unsigned int bits)
+{
+    unsigned int shift = TARGET_PAGE_BITS - tb_jmp_page_bits(bits);
+    unsigned int page_mask = (1u << bits) - tb_jmp_page_size(bits);
     target_ulong tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK;
+
+    tmp = pc ^ (pc >> shift);
+    return (tmp >> shift) & page_mask;
 }
 
-static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
+static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc,
+                                                  unsigned int bits)
 {
+    unsigned int shift = TARGET_PAGE_BITS - tb_jmp_page_bits(bits);
+    unsigned int page_mask = (1u << bits) - tb_jmp_page_size(bits);
+    unsigned int addr_mask = tb_jmp_page_size(bits) - 1;
     target_ulong tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (((tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK)
-           | (tmp & TB_JMP_ADDR_MASK));
+
+    tmp = pc ^ (pc >> shift);
+    return ((tmp >> shift) & page_mask) | (tmp & addr_mask);
 }
 
 #else
 
 /* In user-mode we can get better hashing because we do not have a TLB */
-static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
+static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc,
+                                                  unsigned int bits)
 {
-    return (pc ^ (pc >> TB_JMP_CACHE_BITS)) & (TB_JMP_CACHE_SIZE - 1);
+    return (pc ^ (pc >> bits)) & ((1u << bits) - 1);
 }
 
 #endif /* CONFIG_SOFTMMU */
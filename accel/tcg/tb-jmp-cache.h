@@ -9,23 +9,84 @@
 #ifndef ACCEL_TCG_TB_JMP_CACHE_H
 #define ACCEL_TCG_TB_JMP_CACHE_H
 
+#include "qemu/rcu.h"
+
+/*
+ * The jump cache starts with 1 << TB_JMP_CACHE_BITS entries.  In system
+ * mode it is resized on TLB flushes, between TB_JMP_CACHE_MIN_BITS and
+ * tb_jmp_cache_max_bits, according to how many of its entries were used
+ * since the previous flush; in user mode it keeps its initial size.
+ */
 #define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_MIN_BITS 8
+#define TB_JMP_CACHE_MAX_BITS 18
+#ifdef CONFIG_USER_ONLY
+#define TB_JMP_CACHE_DEFAULT_MAX_BITS TB_JMP_CACHE_BITS
+#else
+#define TB_JMP_CACHE_DEFAULT_MAX_BITS 16
+#endif
+
+/* Set from the "jmp-cache-bits" property of the TCG accelerator */
+extern unsigned int tb_jmp_cache_max_bits;
+
+typedef struct CPUJumpCacheEntry {
+    TranslationBlock *tb;
+#if TARGET_TB_PCREL
+    target_ulong pc;
+#endif
+} CPUJumpCacheEntry;
 
 /*
  * Accessed in parallel; all accesses to 'tb' must be atomic.
  * For TARGET_TB_PCREL, accesses to 'pc' must be protected by
  * a load_acquire/store_release to 'tb'.
+ *
+ * The cache is only ever replaced by the vCPU that owns it, which
+ * publishes the new one with qatomic_rcu_set().  Other threads must
+ * access cpu->tb_jmp_cache within an RCU read-side critical section.
  */
 struct CPUJumpCache {
-    struct {
-        TranslationBlock *tb;
-#if TARGET_TB_PCREL
-        target_ulong pc;
-#endif
-    } array[TB_JMP_CACHE_SIZE];
+    struct rcu_head rcu;
+    /* log2 of the number of entries in @array */
+    unsigned int bits;
+    /*
+     * Lookup statistics, carried over on resize.  Written only by the
+     * owning vCPU, read by others with qatomic_read.
+     */
+    size_t hits;
+    size_t misses;
+    /* Lookups done by helper_lookup_tb_ptr, and by the cpu_exec loop */
+    size_t helper_lookups;
+    size_t loop_lookups;
+    /* Direct jumps patched, and those of them into cross-page TBs */
+    size_t jmp_links;
+    size_t jmp_links_cross_page;
+    /* Entries into cross-page TBs that had to revalidate the 2nd page */
+    size_t page1_check_fails;
+    /* Resize bookkeeping, owning vCPU only */
+    int64_t window_begin_ns;
+    size_t window_max_entries;
+    CPUJumpCacheEntry array[];
 };
 
+static inline CPUJumpCache *tb_jmp_cache_new(unsigned int bits)
+{
+    CPUJumpCache *jc = g_malloc0(sizeof(CPUJumpCache) +
+                                 (sizeof(CPUJumpCacheEntry) << bits));
+
+    jc->bits = bits;
+    return jc;
+}
+
+static inline unsigned int tb_jmp_cache_initial_bits(void)
+{
+#ifdef CONFIG_USER_ONLY
+    return tb_jmp_cache_max_bits;
+#else
+    return MIN(TB_JMP_CACHE_BITS, tb_jmp_cache_max_bits);
+#endif
+}
+
 static inline TranslationBlock *
 tb_jmp_cache_get_tb(CPUJumpCache *jc, uint32_t hash)
 {
@@ -853,13 +853,19 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             tcg_flush_jmp_cache(cpu);
         }
     } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb_pc(tb));
-
-        CPU_FOREACH(cpu) {
-            CPUJumpCache *jc = cpu->tb_jmp_cache;
-
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
+        /* The caches may be resized concurrently by their own vCPU */
+        WITH_RCU_READ_LOCK_GUARD() {
+            CPU_FOREACH(cpu) {
+                CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+                uint32_t h;
+
+                if (!jc) {
+                    continue;
+                }
+                h = tb_jmp_cache_hash_func(tb_pc(tb), jc->bits);
+                if (qatomic_read(&jc->array[h].tb) == tb) {
+                    qatomic_set(&jc->array[h].tb, NULL);
+                }
             }
         }
     }
@@ -869,8 +875,10 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
+ * If @rm_from_jmp_cache is false, the caller flushes the jump caches.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool rm_from_jmp_cache)
 {
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -897,7 +905,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (rm_from_jmp_cache) {
+        tb_jmp_cache_inval_tb(tb);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -913,7 +923,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, true);
     qemu_thread_jit_execute();
 }
 
@@ -925,10 +935,68 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         page_lock_tb(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, true);
         page_unlock_tb(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+static gboolean tb_evict(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    /* TBs that were already invalidated are no longer in the page lists */
+    page_lock_tb(tb);
+    do_tb_phys_invalidate(tb, true, false);
+    page_unlock_tb(tb);
+    return FALSE;
+}
+
+/* evict the oldest translation blocks, or all of them if that fails */
+static void do_tb_flush_partial(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    CPUState *other;
+    size_t evicted = 0;
+
+    mmap_lock();
+    /* A full flush since the request has made room already. */
+    if (tb_ctx.tb_flush_count == tb_flush_count.host_int) {
+        qemu_thread_jit_write();
+        evicted = tcg_region_evict(tb_evict, NULL);
+        qemu_thread_jit_execute();
+        if (evicted) {
+            /*
+             * tb_evict() leaves the jump caches alone; they may also hold
+             * one-shot TBs, which are not in the region trees.
+             */
+            CPU_FOREACH(other) {
+                tcg_flush_jmp_cache(other);
+            }
+            qatomic_set(&tb_ctx.tb_partial_flush_count,
+                        tb_ctx.tb_partial_flush_count + 1);
+        }
+    }
+    mmap_unlock();
+
+    if (!evicted) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+/*
+ * Make room in the code buffer by throwing away the oldest translations,
+ * which leaves the more recently translated code alone.
+ */
+void tb_flush_partial(CPUState *cpu)
+{
+    unsigned tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_flush_partial(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_flush_partial,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
     }
 }
 
@@ -37,6 +37,7 @@
 #include "hw/boards.h"
 #endif
 #include "internal.h"
+#include "tb-jmp-cache.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -44,6 +45,9 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    unsigned int jmp_cache_bits;
+    uint32_t hot_threshold;
+    uint32_t cached_regs;
 };
 typedef struct TCGState TCGState;
 
@@ -106,6 +110,7 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+    s->jmp_cache_bits = TB_JMP_CACHE_DEFAULT_MAX_BITS;
 }
 
 bool mttcg_enabled;
@@ -121,10 +126,16 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_jmp_cache_max_bits = s->jmp_cache_bits;
+    tb_hot_threshold = s->hot_threshold;
+    tcg_cached_regs_max = s->cached_regs;
 
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    if (tb_hot_threshold) {
+        tb_hot_counts = g_new0(int32_t, tcg_tb_index_max());
+    }
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -196,6 +207,96 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_jmp_cache_bits(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->jmp_cache_bits;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_bits(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value < TB_JMP_CACHE_MIN_BITS || value > TB_JMP_CACHE_MAX_BITS) {
+        error_setg(errp, "Invalid 'jmp-cache-bits' %" PRIu32
+                   ", must be between %d and %d",
+                   value, TB_JMP_CACHE_MIN_BITS, TB_JMP_CACHE_MAX_BITS);
+        return;
+    }
+
+    s->jmp_cache_bits = value;
+}
+
+static void tcg_get_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->hot_threshold, errp);
+}
+
+static void tcg_set_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value > INT32_MAX) {
+        error_setg(errp, "Invalid 'hot-threshold' %" PRIu32
+                   ", must be at most %d", value, INT32_MAX);
+        return;
+    }
+
+    s->hot_threshold = value;
+}
+
+static void tcg_get_cached_regs(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->cached_regs, errp);
+}
+
+static void tcg_set_cached_regs(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value > TCG_TARGET_NB_CACHED_REGS) {
+        error_setg(errp, "Invalid 'cached-regs' %" PRIu32
+                   ", this host supports at most %d",
+                   value, TCG_TARGET_NB_CACHED_REGS);
+        return;
+    }
+
+    s->cached_regs = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -241,6 +342,24 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "jmp-cache-bits", "int",
+        tcg_get_jmp_cache_bits, tcg_set_jmp_cache_bits,
+        NULL, NULL);
+    object_class_property_set_description(oc, "jmp-cache-bits",
+        "log2 of the maximum number of entries in the per-vCPU TB jump cache");
+
+    object_class_property_add(oc, "hot-threshold", "int",
+        tcg_get_hot_threshold, tcg_set_hot_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "hot-threshold",
+        "Executions after which a TB is retranslated as a trace (0 = never)");
+
+    object_class_property_add(oc, "cached-regs", "int",
+        tcg_get_cached_regs, tcg_set_cached_regs,
+        NULL, NULL);
+    object_class_property_set_description(oc, "cached-regs",
+        "Guest registers kept in host registers across chained TBs");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -30,6 +30,7 @@
 #include "disas/disas.h"
 #include "exec/log.h"
 #include "tcg/tcg.h"
+#include "internal.h"
 
 /* 32-bit helpers */
 
@@ -148,3 +149,8 @@ void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(env_cpu(env), GETPC());
 }
+
+void HELPER(tb_hot)(CPUArchState *env, void *tb)
+{
+    tb_hot_retranslate(env_cpu(env), tb, GETPC());
+}
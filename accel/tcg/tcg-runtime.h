@@ -27,6 +27,8 @@ DEF_HELPER_FLAGS_1(ctpop_i64, TCG_CALL_NO_RWG_SE, i64, i64)
 DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, cptr, env)
 
 DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
+DEF_HELPER_FLAGS_2(tb_hot, TCG_CALL_NO_WG, noreturn, env, ptr)
+DEF_HELPER_FLAGS_2(tb_check_page1, TCG_CALL_NO_WG, void, env, ptr)
 
 #ifndef IN_HELPER_PROTO
 /*
@@ -70,6 +70,11 @@ QEMU_BUILD_BUG_ON(CPU_TRACE_DSTATE_MAX_EVENTS >
 
 TBContext tb_ctx;
 
+/* Executions of a TB before it is retranslated as a trace, 0 to disable */
+unsigned int tb_hot_threshold;
+/* Per-TB countdown of executions, indexed by tcg_tb_index() */
+int32_t *tb_hot_counts;
+
 /* Encode VAL as a signed leb128 sequence at P.
    Return P incremented past the encoded value.  */
 static uint8_t *encode_sleb128(uint8_t *p, target_long val)
@@ -331,7 +336,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
-        tb_flush(cpu);
+        tb_flush_partial(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -347,6 +352,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    if (tb_hot_counts) {
+        *tb_hot_count(tb) = tb_hot_threshold;
+    }
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     tcg_ctx->tb_cflags = cflags;
@@ -508,6 +516,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tb_reset_jump(tb, 1);
     }
 
+    /*
+     * CF_TRACE only changes how the TB is translated; keep it out of the
+     * cflags used for lookup so that the trace replaces the original TB.
+     */
+    if (cflags & CF_TRACE) {
+        tb->cflags &= ~CF_TRACE;
+        qatomic_inc(&tb_ctx.tb_trace_count);
+    }
+
     /*
      * If the TB is not associated with a physical RAM page then it must be
      * a temporary one-insn TB, and we have nothing left to do. Return early
@@ -569,6 +586,28 @@ void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
     }
 }
 
+/*
+ * Called from the code generated by translator_loop() when @tb has been
+ * executed tb_hot_threshold times: throw it away and have it retranslated
+ * as a trace, starting from the same instruction.
+ */
+void tb_hot_retranslate(CPUState *cpu, TranslationBlock *tb,
+                        uintptr_t retaddr)
+{
+    cpu_restore_state_from_tb(cpu, tb, retaddr);
+
+    /*
+     * The counter is updated without atomics, so other vCPUs may get here
+     * for the same TB; only the first invalidation has any effect.
+     */
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+
+    cpu->cflags_next_tb = curr_cflags(cpu) | CF_TRACE;
+    cpu_loop_exit_noexc(cpu);
+}
+
 #ifndef CONFIG_USER_ONLY
 /*
  * In deterministic execution mode, instructions doing device I/Os
@@ -738,6 +777,10 @@ void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB partial flushes  %u\n",
+                           qatomic_read(&tb_ctx.tb_partial_flush_count));
+    g_string_append_printf(buf, "TB trace count      %u\n",
+                           qatomic_read(&tb_ctx.tb_trace_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
@@ -745,6 +788,38 @@ void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPUState *cpu;
+
+        CPU_FOREACH(cpu) {
+            CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+            size_t hits, misses;
+
+            if (!jc) {
+                continue;
+            }
+            hits = qatomic_read(&jc->hits);
+            misses = qatomic_read(&jc->misses);
+            g_string_append_printf(buf, "vCPU %d jump cache   %zu entries, "
+                                   "%zu hits, %zu misses (%0.1f%% hit rate)\n",
+                                   cpu->cpu_index, (size_t)1 << jc->bits,
+                                   hits, misses, hits + misses ?
+                                   hits * 100.0 / (hits + misses) : 0);
+            g_string_append_printf(buf, "vCPU %d TB lookups   %zu from "
+                                   "lookup helper, %zu from main loop\n",
+                                   cpu->cpu_index,
+                                   qatomic_read(&jc->helper_lookups),
+                                   qatomic_read(&jc->loop_lookups));
+            g_string_append_printf(buf, "vCPU %d direct jumps %zu linked "
+                                   "(%zu cross page), %zu page checks "
+                                   "failed\n",
+                                   cpu->cpu_index,
+                                   qatomic_read(&jc->jmp_links),
+                                   qatomic_read(&jc->jmp_links_cross_page),
+                                   qatomic_read(&jc->page1_check_fails));
+        }
+    }
     tcg_dump_info(buf);
 }
 
@@ -765,14 +840,17 @@ void cpu_interrupt(CPUState *cpu, int mask)
  */
 void tcg_flush_jmp_cache(CPUState *cpu)
 {
-    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    CPUJumpCache *jc;
+
+    RCU_READ_LOCK_GUARD();
+    jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
 
     /* During early initialization, the cache may not yet be allocated. */
     if (unlikely(jc == NULL)) {
         return;
     }
 
-    for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    for (size_t i = 0, n = (size_t)1 << jc->bits; i < n; i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
 }
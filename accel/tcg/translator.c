@@ -17,6 +17,10 @@
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
 #include "sysemu/replay.h"
+#include "internal.h"
+
+/* Upper bound on the jumps followed by a single trace */
+#define TRACE_MAX_JMPS 8
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -39,7 +43,92 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if (((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0) {
+        return true;
+    }
+
+#ifndef CONFIG_USER_ONLY
+    /*
+     * A TB that spans two pages checks the mapping of the second page
+     * when it is entered (see gen_page1_check), so the second page is
+     * as good a destination as the first.
+     */
+    if (tb_page_addr1(db->tb) != -1) {
+        return ((TARGET_PAGE_ALIGN(db->pc_first) ^ dest)
+                & TARGET_PAGE_MASK) == 0;
+    }
+#endif
+    return false;
+}
+
+bool translator_trace_follow(DisasContextBase *db, target_ulong next,
+                             target_ulong dest)
+{
+    if (!(tb_cflags(db->tb) & CF_TRACE) || db->trace_jmps >= TRACE_MAX_JMPS) {
+        return false;
+    }
+
+    /* Forward only, and on the same page as the start of the TB.  */
+    if (dest < next || ((db->pc_first ^ dest) & TARGET_PAGE_MASK) != 0) {
+        return false;
+    }
+
+    db->trace_jmps++;
+    return true;
+}
+
+static bool translator_want_hot_count(const TranslatorOps *ops,
+                                      TranslationBlock *tb)
+{
+    return (ops->can_trace && tb_hot_threshold &&
+            tb_page_addr0(tb) != -1 &&
+            !(tb_cflags(tb) & (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_LAST_IO |
+                               CF_MEMI_ONLY | CF_USE_ICOUNT | CF_NOIRQ |
+                               CF_SINGLE_STEP | CF_TRACE)));
+}
+
+/*
+ * Count down the executions of a TB that may be retranslated as a trace.
+ * This is emitted after the first insn_start, so that the helper can
+ * restore the state to the start of the TB.
+ */
+static void gen_hot_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(tb_hot_count(tb));
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_GT, count, 0, cold);
+    gen_helper_tb_hot(cpu_env, tcg_constant_ptr(tb));
+    gen_set_label(cold);
+    tcg_temp_free_i32(count);
+}
+
+/*
+ * Direct jumps into a TB are not unlinked when the mapping of its pages
+ * changes.  This is fine for the first page, which was checked by the
+ * lookup of the TB that jumps here, but a TB that spans two pages has to
+ * check the second one itself.  Whether the TB spans two pages is only
+ * known at the end of the translation, so the check is emitted for every
+ * TB and removed later if it is not needed.  Like gen_hot_count, this is
+ * emitted after the first insn_start.
+ */
+static TCGOp *gen_page1_check(TranslationBlock *tb)
+{
+#ifdef CONFIG_USER_ONLY
+    /* Page mapping changes invalidate the TBs on the affected pages.  */
+    return NULL;
+#else
+    /* One-shot TBs are never the target of a direct jump.  */
+    if (tb_page_addr0(tb) == -1) {
+        return NULL;
+    }
+    gen_helper_tb_check_page1(cpu_env, tcg_constant_ptr(tb));
+    return tcg_last_op();
+#endif
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
@@ -48,6 +137,8 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
 {
     uint32_t cflags = tb_cflags(tb);
     bool plugin_enabled;
+    bool hot_count = translator_want_hot_count(ops, tb);
+    TCGOp *page1_check = NULL;
 
     /* Initialize DisasContext */
     db->tb = tb;
@@ -57,6 +148,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
     db->num_insns = 0;
     db->max_insns = max_insns;
     db->singlestep_enabled = cflags & CF_SINGLE_STEP;
+    db->trace_jmps = 0;
     db->host_addr[0] = host_pc;
     db->host_addr[1] = NULL;
 
@@ -82,6 +174,13 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
         ops->insn_start(db, cpu);
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
+        if (db->num_insns == 1) {
+            page1_check = gen_page1_check(tb);
+            if (hot_count) {
+                gen_hot_count(tb);
+            }
+        }
+
         if (plugin_enabled) {
             plugin_gen_insn_start(cpu, db);
         }
@@ -125,6 +224,10 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
     ops->tb_stop(db, cpu);
     gen_tb_end(db->tb, db->num_insns);
 
+    if (page1_check && tb_page_addr1(tb) == -1) {
+        tcg_op_remove(tcg_ctx, page1_check);
+    }
+
     if (plugin_enabled) {
         plugin_gen_tb_end(cpu);
     }
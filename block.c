@@ -106,6 +106,9 @@ static bool bdrv_change_aio_context(BlockDriverState *bs, AioContext *ctx,
                                     GHashTable *visited, Transaction *tran,
                                     Error **errp);
 
+static BdrvBlockStatusCache *bdrv_bsc_new(void);
+static void bdrv_bsc_free(BdrvBlockStatusCache *bsc);
+
 /* If non-zero, use only whitelisted block drivers */
 static int use_bdrv_whitelist;
 
@@ -421,8 +424,7 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    bs->block_status_cache = bdrv_bsc_new();
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -4961,7 +4963,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
+    bdrv_bsc_free(bs->block_status_cache);
     bs->block_status_cache = NULL;
 
     bdrv_release_named_dirty_bitmaps(bs);
@@ -8133,31 +8135,51 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
-/**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
- *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
- * Otherwise, *pnum is not touched.
- */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+static BdrvBlockStatusCache *bdrv_bsc_new(void)
+{
+    BdrvBlockStatusCache *bsc = g_new0(BdrvBlockStatusCache, 1);
+
+    qemu_mutex_init(&bsc->lock);
+    QTAILQ_INIT(&bsc->entries);
+    return bsc;
+}
+
+static void bdrv_bsc_free(BdrvBlockStatusCache *bsc)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
+    BdrvBlockStatusCacheEntry *entry, *next;
 
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    if (!bsc) {
+        return;
+    }
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+    QTAILQ_FOREACH_SAFE(entry, &bsc->entries, next, next) {
+        g_free(entry);
     }
+    qemu_mutex_destroy(&bsc->lock);
+    g_free(bsc);
+}
+
+/* Called with bsc->lock held.  */
+static void bdrv_bsc_insert_locked(BdrvBlockStatusCache *bsc,
+                                   int64_t start, int64_t end)
+{
+    BdrvBlockStatusCacheEntry *entry = g_new0(BdrvBlockStatusCacheEntry, 1);
+
+    entry->node.start = start;
+    entry->node.last = end - 1;
+    interval_tree_insert(&entry->node, &bsc->root);
+    QTAILQ_INSERT_TAIL(&bsc->entries, entry, next);
+    bsc->nr_entries++;
+}
 
-    return overlaps;
+/* Called with bsc->lock held.  */
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   BdrvBlockStatusCacheEntry *entry)
+{
+    interval_tree_remove(&entry->node, &bsc->root);
+    QTAILQ_REMOVE(&bsc->entries, entry, next);
+    bsc->nr_entries--;
+    g_free(entry);
 }
 
 /**
@@ -8165,9 +8187,26 @@ static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
  */
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 {
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    BdrvBlockStatusCacheEntry *entry;
+    IntervalTreeNode *node;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    node = interval_tree_iter_first(&bsc->root, offset, offset);
+    if (!node) {
+        return false;
+    }
+
+    entry = container_of(node, BdrvBlockStatusCacheEntry, node);
+    QTAILQ_REMOVE(&bsc->entries, entry, next);
+    QTAILQ_INSERT_TAIL(&bsc->entries, entry, next);
+
+    if (pnum) {
+        *pnum = node->last + 1 - offset;
+    }
+    return true;
 }
 
 /**
@@ -8176,11 +8215,39 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    int64_t end = offset + bytes;
+    IntervalTreeNode *node;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    if (bytes <= 0) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    /*
+     * The head and tail that are left of an overlapping region do not
+     * overlap the range anymore, so this terminates.
+     */
+    while ((node = interval_tree_iter_first(&bsc->root, offset, end - 1))) {
+        int64_t start = node->start;
+        int64_t last = node->last;
+
+        bdrv_bsc_remove_locked(bsc, container_of(node,
+                                                 BdrvBlockStatusCacheEntry,
+                                                 node));
+        if (start < offset) {
+            bdrv_bsc_insert_locked(bsc, start, offset);
+        }
+        if (last >= end) {
+            bdrv_bsc_insert_locked(bsc, end, last + 1);
+        }
+    }
+
+    /* Splitting a region in two may have gone over the limit */
+    if (bsc->nr_entries > BDRV_BSC_MAX_ENTRIES) {
+        bdrv_bsc_remove_locked(bsc, QTAILQ_FIRST(&bsc->entries));
     }
 }
 
@@ -8189,21 +8256,30 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    int64_t start = offset;
+    int64_t end = offset + bytes;
+    IntervalTreeNode *node;
     IO_CODE();
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
+    if (bytes <= 0) {
+        return;
+    }
 
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    /* Merge with all regions that overlap or touch the new one */
+    while ((node = interval_tree_iter_first(&bsc->root, MAX(start, 1) - 1,
+                                            end))) {
+        start = MIN(start, node->start);
+        end = MAX(end, node->last + 1);
+        bdrv_bsc_remove_locked(bsc, container_of(node,
+                                                 BdrvBlockStatusCacheEntry,
+                                                 node));
+    }
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
+    if (bsc->nr_entries >= BDRV_BSC_MAX_ENTRIES) {
+        bdrv_bsc_remove_locked(bsc, QTAILQ_FIRST(&bsc->entries));
     }
+    bdrv_bsc_insert_locked(bsc, start, end);
 }
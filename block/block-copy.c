@@ -26,6 +26,13 @@
 #include "qemu/memalign.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
+/*
+ * Once the target is known to share extents with the source (reflink),
+ * whole extents reported by block-status are cloned with a single
+ * copy_range call up to this size.  A clone only updates metadata, so
+ * overlapping requests do not wait on a long data copy.
+ */
+#define BLOCK_COPY_MAX_CLONE_RANGE (1 * GiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
@@ -37,7 +44,8 @@ typedef enum {
     COPY_READ_WRITE,
     COPY_WRITE_ZEROES,
     COPY_RANGE_SMALL,
-    COPY_RANGE_FULL
+    COPY_RANGE_FULL,
+    COPY_RANGE_CLONE
 } BlockCopyMethod;
 
 static coroutine_fn int block_copy_task_entry(AioTask *task);
@@ -157,6 +165,22 @@ typedef struct BlockCopyState {
     RateLimit rate_limit;
 } BlockCopyState;
 
+/* Largest bounce buffer used by block_copy_do_copy() */
+static int64_t block_copy_buffer_size(BlockCopyState *s)
+{
+    return MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+}
+
+/*
+ * Memory accounted in s->mem for a task.  Tasks larger than the bounce
+ * buffer only happen with copy_range, which falls back to copying through
+ * a buffer of at most block_copy_buffer_size() bytes.
+ */
+static int64_t task_mem(BlockCopyTask *task)
+{
+    return MIN(task->req.bytes, block_copy_buffer_size(task->s));
+}
+
 /* Called with lock held */
 static int64_t block_copy_chunk_size(BlockCopyState *s)
 {
@@ -170,6 +194,9 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     case COPY_RANGE_FULL:
         return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
                    s->max_transfer);
+    case COPY_RANGE_CLONE:
+        return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_CLONE_RANGE),
+                   s->max_transfer);
     default:
         /* Cannot have COPY_WRITE_ZEROES here.  */
         abort();
@@ -441,7 +468,7 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
 
     aio_task_pool_wait_slot(pool);
     if (aio_task_pool_status(pool) < 0) {
-        co_put_to_shres(task->s->mem, task->req.bytes);
+        co_put_to_shres(task->s->mem, task_mem(task));
         block_copy_task_end(task, -ECANCELED);
         g_free(task);
         return -ECANCELED;
@@ -472,6 +499,7 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
 {
     int ret;
     int64_t nbytes = MIN(offset + bytes, s->len) - offset;
+    int64_t buf_size, done;
     void *bounce_buffer = NULL;
 
     assert(offset >= 0 && bytes > 0 && INT64_MAX - offset >= bytes);
@@ -494,6 +522,18 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
 
     case COPY_RANGE_SMALL:
     case COPY_RANGE_FULL:
+    case COPY_RANGE_CLONE:
+        if (*method != COPY_RANGE_FULL) {
+            ret = bdrv_co_copy_range(s->source, offset, s->target, offset,
+                                     nbytes, 0,
+                                     s->write_flags | BDRV_REQ_NO_FALLBACK);
+            if (ret >= 0) {
+                /* Extents are shared, clone whole extents from now on.  */
+                *method = COPY_RANGE_CLONE;
+                return 0;
+            }
+        }
+
         ret = bdrv_co_copy_range(s->source, offset, s->target, offset, nbytes,
                                  0, s->write_flags);
         if (ret >= 0) {
@@ -509,30 +549,32 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
     case COPY_READ_WRITE_CLUSTER:
     case COPY_READ_WRITE:
         /*
-         * In case of failed copy_range request above, we may proceed with
-         * buffered request larger than BLOCK_COPY_MAX_BUFFER.
-         * Still, further requests will be properly limited, so don't care too
-         * much. Moreover the most likely case (copy_range is unsupported for
-         * the configuration, so the very first copy_range request fails)
-         * is handled by setting large copy_size only after first successful
-         * copy_range.
+         * In case of failed copy_range request above, the request may be a
+         * whole extent of up to BLOCK_COPY_MAX_CLONE_RANGE bytes.  Copy it
+         * in pieces, so that the bounce buffer stays within what
+         * task_mem() accounted for.
          */
+        buf_size = MIN(nbytes, block_copy_buffer_size(s));
+        bounce_buffer = qemu_blockalign(s->source->bs, buf_size);
+
+        for (done = 0; done < nbytes; done += buf_size) {
+            int64_t chunk = MIN(nbytes - done, buf_size);
+
+            ret = bdrv_co_pread(s->source, offset + done, chunk,
+                                bounce_buffer, 0);
+            if (ret < 0) {
+                trace_block_copy_read_fail(s, offset + done, ret);
+                *error_is_read = true;
+                goto out;
+            }
 
-        bounce_buffer = qemu_blockalign(s->source->bs, nbytes);
-
-        ret = bdrv_co_pread(s->source, offset, nbytes, bounce_buffer, 0);
-        if (ret < 0) {
-            trace_block_copy_read_fail(s, offset, ret);
-            *error_is_read = true;
-            goto out;
-        }
-
-        ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
-                             s->write_flags);
-        if (ret < 0) {
-            trace_block_copy_write_fail(s, offset, ret);
-            *error_is_read = false;
-            goto out;
+            ret = bdrv_co_pwrite(s->target, offset + done, chunk,
+                                 bounce_buffer, s->write_flags);
+            if (ret < 0) {
+                trace_block_copy_write_fail(s, offset + done, ret);
+                *error_is_read = false;
+                goto out;
+            }
         }
 
     out:
@@ -571,7 +613,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             progress_work_done(s->progress, t->req.bytes);
         }
     }
-    co_put_to_shres(s->mem, t->req.bytes);
+    co_put_to_shres(s->mem, task_mem(t));
     block_copy_task_end(t, ret);
 
     return ret;
@@ -773,7 +815,7 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
 
         trace_block_copy_process(s, task->req.offset);
 
-        co_get_from_shres(s->mem, task->req.bytes);
+        co_get_from_shres(s->mem, task_mem(task));
 
         offset = task_end(task);
         bytes = end - offset;
@@ -35,6 +35,7 @@
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
 
@@ -156,8 +157,16 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool aio_fixed:1;
+#ifdef CONFIG_LINUX_IO_URING
+    /* Registered file slot in the io_uring ring of the AioContext, or -1 */
+    int fixed_file;
+    /* Memory passed to .bdrv_register_buf(), struct iovec */
+    GArray *fixed_bufs;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
+    bool has_reflink;
     bool needs_alignment;
     bool force_alignment;
     bool drop_cache;
@@ -549,6 +558,12 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "aio-fixed",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the file and guest memory with io_uring "
+                    "(default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -577,6 +592,69 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Register the file descriptor and, if @bufs, the memory passed to
+ * .bdrv_register_buf() with the io_uring ring of @ctx.  Failures only
+ * mean that the fast path is not used, so they are not fatal.
+ */
+static void raw_fixed_register(BlockDriverState *bs, AioContext *ctx,
+                               bool bufs)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio;
+    int ret;
+
+    if (!s->aio_fixed || !s->use_linux_io_uring) {
+        return;
+    }
+
+    aio = aio_get_linux_io_uring(ctx);
+    aio_context_acquire(ctx);
+    assert(s->fixed_file == -1);
+    ret = luring_register_file(aio, s->fd);
+    if (ret < 0) {
+        warn_report("%s: failed to register file with io_uring: %s",
+                    bs->filename, strerror(-ret));
+    } else {
+        s->fixed_file = ret;
+    }
+
+    for (guint i = 0; bufs && i < s->fixed_bufs->len; i++) {
+        struct iovec *iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+
+        luring_register_buf(aio, iov->iov_base, iov->iov_len);
+    }
+    aio_context_release(ctx);
+}
+
+/* Undo raw_fixed_register() */
+static void raw_fixed_unregister(BlockDriverState *bs, AioContext *ctx,
+                                 bool bufs)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio;
+
+    if (!s->aio_fixed || !s->use_linux_io_uring) {
+        return;
+    }
+
+    aio = aio_get_linux_io_uring(ctx);
+    aio_context_acquire(ctx);
+    if (s->fixed_file >= 0) {
+        luring_unregister_file(aio, s->fixed_file);
+        s->fixed_file = -1;
+    }
+
+    for (guint i = 0; bufs && i < s->fixed_bufs->len; i++) {
+        struct iovec *iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+
+        luring_unregister_buf(aio, iov->iov_base, iov->iov_len);
+    }
+    aio_context_release(ctx);
+}
+#endif
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -626,10 +704,18 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->fixed_file = -1;
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+    s->aio_fixed = qemu_opt_get_bool(opts, "aio-fixed", false);
+    if (s->aio_fixed && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -755,6 +841,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             goto fail;
         } else {
             s->has_fallocate = true;
+            s->has_reflink = true;
         }
     } else {
         if (!(S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))) {
@@ -795,6 +882,19 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->aio_fixed) {
+        /* Registered guest memory is pinned, like with VFIO */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+            goto fail;
+        }
+        s->fixed_bufs = g_array_new(false, false, sizeof(struct iovec));
+        raw_fixed_register(bs, bdrv_get_aio_context(bs), true);
+    }
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1792,6 +1892,56 @@ static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
 }
 #endif
 
+#ifdef FICLONERANGE
+/*
+ * Share the extents of the source with the destination instead of copying
+ * them, on filesystems that support it (btrfs, XFS with reflink=1, ...).
+ * Returns false if the range must be copied with copy_file_range().
+ */
+static bool raw_clone_range(RawPosixAIOData *aiocb)
+{
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd = aiocb->aio_fildes,
+        .src_offset = aiocb->aio_offset,
+        .src_length = aiocb->aio_nbytes,
+        .dest_offset = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!s->has_reflink) {
+        return false;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    } while (ret < 0 && errno == EINTR);
+    trace_file_clone_range(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                           aiocb->copy_range.aio_fd2,
+                           aiocb->copy_range.aio_offset2, aiocb->aio_nbytes,
+                           ret < 0 ? -errno : ret);
+    if (ret == 0) {
+        return true;
+    }
+
+    switch (errno) {
+    case ENOTTY:
+    case EOPNOTSUPP:
+        /* Not supported by the filesystem of this node */
+        s->has_reflink = false;
+        break;
+    default:
+        /*
+         * E.g. EXDEV when the source is on another filesystem, or a range
+         * that is not aligned to the filesystem block size.  Both only
+         * concern this request, other sources may still be cloned.
+         */
+        break;
+    }
+    return false;
+}
+#endif
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -1799,6 +1949,15 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+#ifdef FICLONERANGE
+    if (raw_clone_range(aiocb)) {
+        return 0;
+    }
+#endif
+    if (aiocb->aio_type & QEMU_AIO_NO_FALLBACK) {
+        return -ENOTSUP;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2075,7 +2234,8 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
-                                   uint64_t bytes, QEMUIOVector *qiov, int type)
+                                   uint64_t bytes, QEMUIOVector *qiov, int type,
+                                   BdrvRequestFlags flags)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
@@ -2095,7 +2255,8 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
     } else if (s->use_linux_io_uring) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
         assert(qiov->size == bytes);
-        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        return luring_co_submit(bs, aio, s->fd, s->fixed_file, offset, qiov,
+                                type, flags);
 #endif
 #ifdef CONFIG_LINUX_AIO
     } else if (s->use_linux_aio) {
@@ -2126,14 +2287,14 @@ static int coroutine_fn raw_co_preadv(BlockDriverState *bs, int64_t offset,
                                       int64_t bytes, QEMUIOVector *qiov,
                                       BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ);
+    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ, flags);
 }
 
 static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, int64_t offset,
                                        int64_t bytes, QEMUIOVector *qiov,
                                        BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE, flags);
 }
 
 static void raw_aio_plug(BlockDriverState *bs)
@@ -2190,7 +2351,8 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, aio, s->fd, s->fixed_file, 0, NULL,
+                                QEMU_AIO_FLUSH, 0);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
@@ -2218,6 +2380,62 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
         }
+        raw_fixed_register(bs, new_context, true);
+    }
+#endif
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    raw_fixed_unregister(bs, bdrv_get_aio_context(bs), true);
+#endif
+}
+
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    struct iovec iov = { .iov_base = host, .iov_len = size };
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    if (!s->aio_fixed) {
+        return true;
+    }
+
+    g_array_append_val(s->fixed_bufs, iov);
+    if (s->use_linux_io_uring) {
+        aio_context_acquire(ctx);
+        luring_register_buf(aio_get_linux_io_uring(ctx), host, size);
+        aio_context_release(ctx);
+    }
+#endif
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    if (!s->aio_fixed) {
+        return;
+    }
+
+    for (guint i = 0; i < s->fixed_bufs->len; i++) {
+        struct iovec *iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+
+        if (iov->iov_base == host && iov->iov_len == size) {
+            g_array_remove_index_fast(s->fixed_bufs, i);
+            break;
+        }
+    }
+    if (s->use_linux_io_uring) {
+        aio_context_acquire(ctx);
+        luring_unregister_buf(aio_get_linux_io_uring(ctx), host, size);
+        aio_context_release(ctx);
     }
 #endif
 }
@@ -2226,6 +2444,15 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->aio_fixed) {
+        raw_fixed_unregister(bs, bdrv_get_aio_context(bs), true);
+        g_array_free(s->fixed_bufs, true);
+        s->fixed_bufs = NULL;
+        ram_block_discard_disable(false);
+    }
+#endif
+
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -3222,9 +3449,15 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        raw_fixed_unregister(bs, bdrv_get_aio_context(bs), false);
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+#ifdef CONFIG_LINUX_IO_URING
+        raw_fixed_register(bs, bdrv_get_aio_context(bs), false);
+#endif
     }
     s->perm_change_fd = 0;
 
@@ -3291,6 +3524,10 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
         },
     };
 
+    if (write_flags & BDRV_REQ_NO_FALLBACK) {
+        acb.aio_type |= QEMU_AIO_NO_FALLBACK;
+    }
+
     return raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
 }
 
@@ -3324,6 +3561,9 @@ BlockDriver bdrv_file = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate = raw_co_truncate,
     .bdrv_getlength = raw_getlength,
@@ -3696,6 +3936,9 @@ static BlockDriver bdrv_host_device = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate       = raw_co_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -3820,6 +4063,9 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -3950,6 +4196,9 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -2292,7 +2292,9 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
          * This is especially problematic for images with large data areas,
          * because finding the few holes in them and giving them special
          * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * cache the identified data regions, so that repeated queries over
+         * the same range (e.g. by mirror or qemu-img map followed by
+         * convert) do not go to the driver again.
          *
          * Second, limiting ourselves to protocol nodes allows us to assume
          * the block status for data regions to be DATA | OFFSET_VALID, and
@@ -2319,8 +2321,8 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
              * the cache is queried above.  Technically, we do not need to check
              * it here; the worst that can happen is that we fill the cache for
              * non-protocol nodes, and then it is never used.  However, filling
-             * the cache requires an RCU update, so double check here to avoid
-             * such an update if possible.
+             * the cache requires taking its mutex, so double check here to
+             * avoid that if possible.
              *
              * Check want_zero, because we only want to update the cache when we
              * have accurate information about what is zero and what is data.
@@ -3234,9 +3236,7 @@ static int coroutine_fn bdrv_co_copy_range_internal(
     BdrvTrackedRequest req;
     int ret;
 
-    /* TODO We can support BDRV_REQ_NO_FALLBACK here */
     assert(!(read_flags & BDRV_REQ_NO_FALLBACK));
-    assert(!(write_flags & BDRV_REQ_NO_FALLBACK));
     assert(!(read_flags & BDRV_REQ_NO_WAIT));
     assert(!(write_flags & BDRV_REQ_NO_WAIT));
 
@@ -3473,6 +3473,9 @@ int coroutine_fn bdrv_co_truncate(BdrvChild *child, int64_t offset, bool exact,
         goto out;
     }
 
+    /* Whatever lies beyond the new end cannot be cached as data anymore */
+    bdrv_bsc_invalidate_range(bs, offset, INT64_MAX - offset);
+
     ret = refresh_total_sectors(bs, offset >> BDRV_SECTOR_BITS);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not refresh total sector count");
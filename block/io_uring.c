@@ -15,12 +15,26 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in the registered file table of a ring */
+#define MAX_FIXED_FILES 64
+
+/* The kernel does not accept registered buffers larger than this */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
+typedef struct LuringFixedBuf {
+    void *host;
+    size_t size;
+    unsigned int refcnt;
+} LuringFixedBuf;
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -55,6 +69,25 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Registered files and buffers.  Protected by AioContext lock.
+     *
+     * Queued and in-flight sqes refer to registered files and buffers by
+     * index, so entries are only removed from the kernel tables while the
+     * ring is idle; until then removed buffers are hidden from lookups and
+     * removed files keep their slot.
+     */
+    bool fixed_files_registered;
+    int fixed_files[MAX_FIXED_FILES];       /* fd in kernel table or -1 */
+    bool fixed_files_used[MAX_FIXED_FILES]; /* slot owned by a caller */
+    bool fixed_files_stale;                 /* unowned slots to clear */
+
+    GArray *fixed_bufs;                     /* LuringFixedBuf */
+    struct iovec *fixed_iovs;               /* kernel table, sorted */
+    unsigned int nr_fixed_iovs;
+    bool fixed_bufs_stale;                  /* kernel table is outdated */
+    bool fixed_bufs_failed;                 /* registration failed */
 } LuringState;
 
 /**
@@ -99,8 +132,14 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Same registered buffer, just further in */
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+    } else {
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
@@ -260,6 +299,122 @@ static int ioq_submit(LuringState *s)
     return ret;
 }
 
+static bool luring_idle(LuringState *s)
+{
+    return s->io_q.in_queue == 0 && s->io_q.in_flight == 0;
+}
+
+static int luring_fixed_iov_cmp(const void *a, const void *b)
+{
+    const struct iovec *iov_a = a;
+    const struct iovec *iov_b = b;
+
+    if (iov_a->iov_base == iov_b->iov_base) {
+        return 0;
+    }
+    return iov_a->iov_base < iov_b->iov_base ? -1 : 1;
+}
+
+/* Replace the kernel's buffer table with the contents of s->fixed_bufs */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    g_autofree struct iovec *iovs = NULL;
+    unsigned int nr_iovs = 0;
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; i < s->fixed_bufs->len; i++) {
+        LuringFixedBuf *buf = &g_array_index(s->fixed_bufs, LuringFixedBuf, i);
+
+        nr_iovs += DIV_ROUND_UP(buf->size, MAX_FIXED_BUF_SIZE);
+    }
+
+    iovs = g_new(struct iovec, nr_iovs);
+    nr_iovs = 0;
+    for (i = 0; i < s->fixed_bufs->len; i++) {
+        LuringFixedBuf *buf = &g_array_index(s->fixed_bufs, LuringFixedBuf, i);
+        size_t offset;
+
+        for (offset = 0; offset < buf->size; offset += MAX_FIXED_BUF_SIZE) {
+            iovs[nr_iovs].iov_base = buf->host + offset;
+            iovs[nr_iovs].iov_len = MIN(buf->size - offset, MAX_FIXED_BUF_SIZE);
+            nr_iovs++;
+        }
+    }
+    qsort(iovs, nr_iovs, sizeof(*iovs), luring_fixed_iov_cmp);
+
+    if (s->nr_fixed_iovs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->fixed_iovs);
+        s->fixed_iovs = NULL;
+        s->nr_fixed_iovs = 0;
+    }
+    if (nr_iovs) {
+        ret = io_uring_register_buffers(&s->ring, iovs, nr_iovs);
+        if (ret < 0) {
+            warn_report("io_uring: failed to register guest memory (%s), "
+                        "using non-registered buffers", strerror(-ret));
+            s->fixed_bufs_failed = true;
+        } else {
+            s->fixed_iovs = g_steal_pointer(&iovs);
+            s->nr_fixed_iovs = nr_iovs;
+        }
+    }
+    trace_luring_update_fixed_bufs(s, nr_iovs, ret);
+    s->fixed_bufs_stale = false;
+}
+
+/* Apply pending changes to the registered files and buffers if idle */
+static void luring_update_fixed(LuringState *s)
+{
+    int i;
+
+    if (!luring_idle(s)) {
+        return;
+    }
+
+    if (s->fixed_files_stale) {
+        for (i = 0; i < MAX_FIXED_FILES; i++) {
+            int fd = -1;
+
+            if (s->fixed_files_used[i] || s->fixed_files[i] == -1) {
+                continue;
+            }
+            if (io_uring_register_files_update(&s->ring, i, &fd, 1) == 1) {
+                s->fixed_files[i] = -1;
+            }
+        }
+        s->fixed_files_stale = false;
+    }
+
+    if (s->fixed_bufs_stale && !s->fixed_bufs_failed) {
+        luring_update_fixed_bufs(s);
+    }
+}
+
+/*
+ * Returns the index of the registered buffer that contains [base, base + len)
+ * or -1.
+ */
+static int luring_find_fixed_buf(LuringState *s, void *base, size_t len)
+{
+    unsigned int lo = 0, hi = s->nr_fixed_iovs;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        struct iovec *iov = &s->fixed_iovs[mid];
+
+        if (base < iov->iov_base) {
+            hi = mid;
+        } else if (base >= iov->iov_base + iov->iov_len) {
+            lo = mid + 1;
+        } else {
+            return base + len <= iov->iov_base + iov->iov_len ? mid : -1;
+        }
+    }
+    return -1;
+}
+
 static void luring_process_completions_and_submit(LuringState *s)
 {
     aio_context_acquire(s->aio_context);
@@ -268,6 +423,7 @@ static void luring_process_completions_and_submit(LuringState *s)
     if (!s->io_q.plugged && s->io_q.in_queue > 0) {
         ioq_submit(s);
     }
+    luring_update_fixed(s);
     aio_context_release(s->aio_context);
 }
 
@@ -325,29 +481,55 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
 
 /**
  * luring_do_submit:
- * @fd: file descriptor for I/O
+ * @fd: file descriptor for I/O, or registered file slot if @fixed_file
+ * @fixed_file: whether @fd is a slot returned by luring_register_file()
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
  * @type: type of request
+ * @flags: request flags
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, bool fixed_file, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type,
+                            BdrvRequestFlags flags)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int buf_index = -1;
+
+    /* The kernel tables may only change while nothing refers to them */
+    luring_update_fixed(s);
+
+    /* Fixed buffer operations take a single buffer */
+    if ((flags & BDRV_REQ_REGISTERED_BUF) && luringcb->qiov &&
+        luringcb->qiov->niov == 1) {
+        buf_index = luring_find_fixed_buf(s, luringcb->qiov->iov[0].iov_base,
+                                          luringcb->qiov->iov[0].iov_len);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -357,6 +539,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_file) {
+        io_uring_sqe_set_flags(sqes, IOSQE_FIXED_FILE);
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -374,7 +559,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                  uint64_t offset, QEMUIOVector *qiov, int type)
+                                  int fixed_file, uint64_t offset,
+                                  QEMUIOVector *qiov, int type,
+                                  BdrvRequestFlags flags)
 {
     int ret;
     LuringAIOCB luringcb = {
@@ -383,9 +570,15 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
     };
-    trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
-                           type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    trace_luring_co_submit(bs, s, &luringcb, fd, fixed_file, offset,
+                           qiov ? qiov->size : 0, type);
+    if (fixed_file >= 0) {
+        assert(s->fixed_files_used[fixed_file]);
+        ret = luring_do_submit(fixed_file, true, &luringcb, s, offset, type,
+                               flags);
+    } else {
+        ret = luring_do_submit(fd, false, &luringcb, s, offset, type, flags);
+    }
 
     if (ret < 0) {
         return ret;
@@ -414,15 +607,136 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+int luring_register_file(LuringState *s, int fd)
 {
-    int rc;
+    int i, ret;
+
+    if (!s->fixed_files_registered) {
+        /* Register a sparse table, slots are filled in on demand */
+        ret = io_uring_register_files(&s->ring, s->fixed_files,
+                                      MAX_FIXED_FILES);
+        if (ret < 0) {
+            return ret;
+        }
+        s->fixed_files_registered = true;
+    }
+
+    /*
+     * Filling an empty slot is safe at any time, since no sqe refers to it.
+     * Slots that still hold a file are not reused, even for the same fd
+     * number: it may refer to another file by now.
+     */
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (!s->fixed_files_used[i] && s->fixed_files[i] == -1) {
+            break;
+        }
+    }
+    if (i == MAX_FIXED_FILES) {
+        return -ENFILE;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, i, &fd, 1);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->fixed_files[i] = fd;
+    s->fixed_files_used[i] = true;
+    trace_luring_register_file(s, fd, i);
+    return i;
+}
+
+void luring_unregister_file(LuringState *s, int slot)
+{
+    assert(slot >= 0 && slot < MAX_FIXED_FILES);
+    assert(s->fixed_files_used[slot]);
+
+    trace_luring_unregister_file(s, s->fixed_files[slot], slot);
+    s->fixed_files_used[slot] = false;
+    s->fixed_files_stale = true;
+    luring_update_fixed(s);
+}
+
+void luring_register_buf(LuringState *s, void *host, size_t size)
+{
+    LuringFixedBuf new_buf = {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+    };
+    unsigned int i;
+
+    for (i = 0; i < s->fixed_bufs->len; i++) {
+        LuringFixedBuf *buf = &g_array_index(s->fixed_bufs, LuringFixedBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            buf->refcnt++;
+            return;
+        }
+    }
+
+    g_array_append_val(s->fixed_bufs, new_buf);
+    s->fixed_bufs_stale = true;
+    luring_update_fixed(s);
+}
+
+void luring_unregister_buf(LuringState *s, void *host, size_t size)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->fixed_bufs->len; i++) {
+        LuringFixedBuf *buf = &g_array_index(s->fixed_bufs, LuringFixedBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            break;
+        }
+    }
+    if (i == s->fixed_bufs->len ||
+        --g_array_index(s->fixed_bufs, LuringFixedBuf, i).refcnt) {
+        return;
+    }
+    g_array_remove_index_fast(s->fixed_bufs, i);
+
+    /*
+     * The memory may be unmapped and something else mapped at the same
+     * address before the kernel table is updated, so stop using it now.
+     */
+    for (i = 0; i < s->nr_fixed_iovs; i++) {
+        struct iovec *iov = &s->fixed_iovs[i];
+
+        if (iov->iov_base >= host && iov->iov_base < host + size) {
+            iov->iov_len = 0;
+        }
+    }
+    s->fixed_bufs_stale = true;
+    luring_update_fixed(s);
+}
+
+LuringState *luring_init(int64_t sqpoll_idle_ms, Error **errp)
+{
+    int rc, i;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll_idle_ms) {
+        struct io_uring_params params = {
+            .flags = IORING_SETUP_SQPOLL,
+            .sq_thread_idle = MIN(sqpoll_idle_ms, UINT32_MAX),
+        };
+
+        rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+        if (rc < 0) {
+            warn_report("io_uring: submission queue polling not available "
+                        "(%s), using regular submission", strerror(-rc));
+        }
+    } else {
+        rc = -EINVAL;
+    }
+    if (rc < 0) {
+        rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    }
     if (rc < 0) {
         error_setg_errno(errp, errno, "failed to init linux io_uring ring");
         g_free(s);
@@ -430,13 +744,20 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_files[i] = -1;
+    }
+    s->fixed_bufs = g_array_new(false, false, sizeof(LuringFixedBuf));
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    /* This also drops the registered files and buffers */
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
+    g_array_free(s->fixed_bufs, true);
+    g_free(s->fixed_iovs);
     g_free(s);
 }
@@ -2344,6 +2344,10 @@ static int coroutine_fn iscsi_co_copy_range_to(BlockDriverState *bs,
     if (src->bs->drv->bdrv_co_copy_range_to != iscsi_co_copy_range_to) {
         return -ENOTSUP;
     }
+    if (write_flags & BDRV_REQ_NO_FALLBACK) {
+        /* EXTENDED COPY moves the data on the target, it cannot share it */
+        return -ENOTSUP;
+    }
     src_lun = src->bs->opaque;
 
     if (!src_lun->dd || !dst_lun->dd) {
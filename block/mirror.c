@@ -25,9 +25,21 @@
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
 
-#define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
-#define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+#define MIN_IO_BYTES (64 * KiB)
+
+/*
+ * The number of copy operations in flight is tuned at run time between
+ * MIN_IN_FLIGHT and MAX_IN_FLIGHT, starting at DEFAULT_IN_FLIGHT; see
+ * mirror_tune().
+ */
+#define MIN_IN_FLIGHT 2
+#define DEFAULT_IN_FLIGHT 16
+#define MAX_IN_FLIGHT 128
+#define DEFAULT_MIRROR_BUF_SIZE (DEFAULT_IN_FLIGHT * MAX_IO_BYTES)
+
+/* Minimum length of a measurement window for mirror_tune() */
+#define MIRROR_TUNE_INTERVAL_NS (100 * SCALE_MS)
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -85,6 +97,26 @@ typedef struct MirrorBlockJob {
     int64_t active_write_bytes_in_flight;
     bool prepared;
     bool in_drain;
+
+    /*
+     * Current limits for background copying, adjusted by mirror_tune().
+     * Read by mirror_query() outside the job's AioContext.
+     */
+    unsigned max_in_flight;
+    int max_io_bytes;
+
+    /* Measurement window for mirror_tune() */
+    int64_t tune_start_ns;
+    uint64_t tune_bytes;
+    uint64_t tune_latency_ns;
+    unsigned tune_ops;
+    /* Set if the job had to wait for a free slot during the window */
+    bool tune_saturated;
+    /* Results of the previous window, 0 if there was none */
+    uint64_t tune_last_bps;
+    uint64_t tune_last_latency_ns;
+    /* Direction of the last adjustment, +1 or -1 */
+    int tune_step;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -106,6 +138,8 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    /* When the write to the target was submitted, 0 if not a copy */
+    int64_t write_start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -185,6 +219,95 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+static void mirror_set_max_in_flight(MirrorBlockJob *s, unsigned max_in_flight)
+{
+    int64_t io_bytes;
+
+    /*
+     * Split the buffer evenly between the operations, so that a deep queue
+     * uses smaller requests and a shallow one larger requests.
+     */
+    io_bytes = MAX(s->buf_size / max_in_flight, MIN_IO_BYTES);
+    io_bytes = MIN(io_bytes, BDRV_REQUEST_MAX_BYTES);
+    io_bytes = MAX(QEMU_ALIGN_DOWN(io_bytes, s->granularity), s->granularity);
+
+    qatomic_set(&s->max_in_flight, max_in_flight);
+    qatomic_set(&s->max_io_bytes, io_bytes);
+}
+
+static void mirror_tune_reset(MirrorBlockJob *s)
+{
+    s->tune_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->tune_bytes = 0;
+    s->tune_latency_ns = 0;
+    s->tune_ops = 0;
+    s->tune_saturated = false;
+}
+
+/*
+ * Adjust the number of copy operations in flight by hill climbing on the
+ * throughput measured at the target.  While the queue is the bottleneck
+ * (the job had to wait for free slots) the depth keeps moving in the same
+ * direction as long as that improves throughput, and turns around when
+ * throughput drops.  If throughput stays the same but latency goes up, the
+ * extra requests only queue up in the target and the depth is reduced.
+ *
+ * High-latency targets thus end up with many smaller requests in flight,
+ * while fast local targets settle on a few large ones.
+ */
+static void mirror_tune(MirrorBlockJob *s)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->tune_start_ns;
+    unsigned depth = s->max_in_flight;
+    unsigned step, max_depth;
+    uint64_t bps, latency_ns;
+
+    if (elapsed < MIRROR_TUNE_INTERVAL_NS || s->tune_ops < depth) {
+        return;
+    }
+
+    bps = muldiv64(s->tune_bytes, SCALE_MS,
+                   MIN(elapsed / SCALE_US, UINT32_MAX));
+    latency_ns = s->tune_latency_ns / s->tune_ops;
+
+    if (!s->tune_saturated) {
+        /* Not limited by the queue depth, nothing to learn */
+        s->tune_last_bps = 0;
+        mirror_tune_reset(s);
+        return;
+    }
+
+    if (s->tune_last_bps) {
+        if (bps * 20 < s->tune_last_bps * 19) {
+            /* More than 5% worse, go back */
+            s->tune_step = -s->tune_step;
+        } else if (bps * 20 <= s->tune_last_bps * 21 &&
+                   latency_ns * 10 > s->tune_last_latency_ns * 11) {
+            /* Same throughput for more latency */
+            s->tune_step = -1;
+        }
+    }
+
+    max_depth = MAX(MIN(s->buf_size / MIN_IO_BYTES, MAX_IN_FLIGHT),
+                    MIN_IN_FLIGHT);
+    step = MAX(depth / 4, 1);
+    if (s->tune_step > 0) {
+        depth = MIN(depth + step, max_depth);
+    } else {
+        depth = MAX(depth - MIN(step, depth), MIN_IN_FLIGHT);
+    }
+
+    if (depth != s->max_in_flight) {
+        mirror_set_max_in_flight(s, depth);
+        trace_mirror_tune(s, bps, latency_ns, depth, s->max_io_bytes);
+    }
+
+    s->tune_last_bps = bps;
+    s->tune_last_latency_ns = latency_ns;
+    mirror_tune_reset(s);
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -209,6 +332,13 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
     bitmap_clear(s->in_flight_bitmap, chunk_num, nb_chunks);
     QTAILQ_REMOVE(&s->ops_in_flight, op, next);
     if (ret >= 0) {
+        if (op->write_start_ns) {
+            s->tune_bytes += op->bytes;
+            s->tune_latency_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                  op->write_start_ns;
+            s->tune_ops++;
+            mirror_tune(s);
+        }
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
@@ -256,6 +386,7 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    op->write_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
     mirror_write_complete(op, ret);
 }
@@ -478,7 +609,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = s->max_io_bytes;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -582,8 +713,9 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
+            s->tune_saturated = true;
             mirror_wait_for_free_in_flight_slot(s);
         }
 
@@ -835,7 +967,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -967,6 +1099,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         s->cow_bitmap = bitmap_new(length);
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
+    mirror_set_max_in_flight(s, s->max_in_flight);
+    mirror_tune_reset(s);
 
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
@@ -1021,8 +1155,11 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
+                if (cnt != 0) {
+                    s->tune_saturated = true;
+                }
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
@@ -1209,6 +1346,16 @@ static bool mirror_cancel(Job *job, bool force)
     return force;
 }
 
+static void mirror_query(BlockJob *job, BlockJobInfo *info)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+
+    info->u.mirror = (BlockJobInfoMirror) {
+        .max_in_flight = qatomic_read(&s->max_in_flight),
+        .chunk_size = qatomic_read(&s->max_io_bytes),
+    };
+}
+
 static bool commit_active_cancel(Job *job, bool force)
 {
     /* Same as above in mirror_cancel() */
@@ -1229,6 +1376,7 @@ static const BlockJobDriver mirror_job_driver = {
         .cancel                 = mirror_cancel,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = mirror_query,
 };
 
 static const BlockJobDriver commit_active_job_driver = {
@@ -1782,6 +1930,8 @@ static BlockJob *mirror_start_job(
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->tune_step = 1;
+    mirror_set_max_in_flight(s, DEFAULT_IN_FLIGHT);
     s->unmap = unmap;
     if (auto_complete) {
         s->should_complete = true;
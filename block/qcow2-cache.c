@@ -24,14 +24,46 @@
 
 #include "qemu/osdep.h"
 #include "qemu/memalign.h"
+#include "qemu/lockable.h"
+#include "qemu/queue.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qom/object_interfaces.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/* Minimum time between two rebalancing rounds of a cache pool */
+#define QCOW2_CACHE_POOL_INTERVAL_NS (100 * SCALE_MS)
+
+/* Maximum number of entries evicted per miss when a cache has to shrink */
+#define QCOW2_CACHE_SHRINK_BATCH 32
+
+struct Qcow2CachePool {
+    Object parent_obj;
+
+    /* Protects all fields below and the pool_* fields of member caches */
+    QemuMutex lock;
+    /* Memory budget shared by all member caches, in bytes */
+    uint64_t size;
+    int64_t last_rebalance_ns;
+    QLIST_HEAD(, Qcow2Cache) caches;
+};
+
+DECLARE_INSTANCE_CHECKER(Qcow2CachePool, QCOW2_CACHE_POOL,
+                         TYPE_QCOW2_CACHE_POOL)
+
+static void qcow2_cache_pool_maybe_rebalance(Qcow2CachePool *pool);
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    /* Bucket of c->hash, only while offset != 0 */
+    QLIST_ENTRY(Qcow2CachedTable) hash_entry;
+    /* Position in c->lru (offset != 0) or c->free (offset == 0), if ref == 0 */
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -43,6 +75,33 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Cached tables indexed by offset, 1 << hash_bits buckets */
+    QLIST_HEAD(, Qcow2CachedTable) *hash;
+    int                     hash_bits;
+
+    /* Unreferenced entries holding a table, least recently used first */
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
+    /* Empty entries, reused before evicting anything */
+    QTAILQ_HEAD(, Qcow2CachedTable) free;
+    int                     nb_free;
+
+    /*
+     * Maximum number of entries in use.  This is c->size unless the cache
+     * is part of a pool, which may lower it at any time.
+     */
+    int                     limit;
+
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
+
+    Qcow2CachePool         *pool;
+    QLIST_ENTRY(Qcow2Cache) pool_entry;
+    /* Written only by the owner of the cache, read by the pool */
+    unsigned                pool_misses;
+    /* Value of pool_misses at the last rebalancing, protected by pool->lock */
+    unsigned                pool_last_misses;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -58,6 +117,66 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    /* Fibonacci hashing, table offsets are often allocated with a stride */
+    return ((offset / c->table_size) * 0x9e3779b97f4a7c15ULL) >>
+           (64 - c->hash_bits);
+}
+
+/* Change the offset of entry @i, keeping the hash table up to date */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, uint64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset) {
+        QLIST_REMOVE(t, hash_entry);
+    }
+    t->offset = offset;
+    if (offset) {
+        QLIST_INSERT_HEAD(&c->hash[qcow2_cache_hash(c, offset)], t,
+                          hash_entry);
+    }
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    Qcow2CachedTable *t;
+
+    QLIST_FOREACH(t, &c->hash[qcow2_cache_hash(c, offset)], hash_entry) {
+        if (t->offset == offset) {
+            return t - c->entries;
+        }
+    }
+    return -1;
+}
+
+static void qcow2_cache_free_insert(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    QTAILQ_INSERT_HEAD(&c->free, t, lru_entry);
+    c->nb_free++;
+}
+
+static void qcow2_cache_free_remove(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    QTAILQ_REMOVE(&c->free, t, lru_entry);
+    c->nb_free--;
+}
+
+/* Move unreferenced entry @i to the free list */
+static void qcow2_cache_entry_clear(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    assert(t->ref == 0);
+    if (t->offset) {
+        qcow2_cache_set_offset(c, i, 0);
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+        qcow2_cache_free_insert(c, t);
+    }
+    t->lru_counter = 0;
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -105,8 +224,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_clear(c, i);
             i++;
             to_clean++;
         }
@@ -124,6 +242,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -136,12 +255,23 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
+    /* At least one bucket per entry, but no less than two buckets */
+    c->hash_bits = MAX(ctz32(pow2ceil(num_tables)), 1);
+    c->hash = g_try_new0(typeof(*c->hash), 1 << c->hash_bits);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->table_array || !c->hash) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->hash);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    c->limit = num_tables;
+    QTAILQ_INIT(&c->lru);
+    QTAILQ_INIT(&c->free);
+    for (i = num_tables - 1; i >= 0; i--) {
+        qcow2_cache_free_insert(c, &c->entries[i]);
     }
 
     return c;
@@ -155,8 +285,11 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    qcow2_cache_set_pool(c, NULL);
+
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->hash);
     g_free(c);
 
     return 0;
@@ -305,9 +438,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     }
 
     for (i = 0; i < c->size; i++) {
-        assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        qcow2_cache_entry_clear(c, i);
     }
 
     qcow2_cache_table_release(c, 0, c->size);
@@ -317,15 +448,45 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+/*
+ * Evict least recently used tables while the cache uses more entries than
+ * its pool allows.  The work is spread over several misses so that a large
+ * cut in the limit does not stall a single request.
+ */
+static void qcow2_cache_shrink(BlockDriverState *bs, Qcow2Cache *c)
+{
+    int n;
+
+    for (n = 0; n < QCOW2_CACHE_SHRINK_BATCH; n++) {
+        Qcow2CachedTable *t = QTAILQ_FIRST(&c->lru);
+        int i;
+
+        if (!t || c->size - c->nb_free <= qatomic_read(&c->limit)) {
+            break;
+        }
+
+        i = t - c->entries;
+        if (qcow2_cache_entry_flush(bs, c, i) < 0) {
+            break;
+        }
+        /* Flushing may yield, check again that the entry is unused */
+        if (t->ref != 0 || !t->offset) {
+            continue;
+        }
+        c->evictions++;
+        qcow2_cache_entry_clear(c, i);
+        qcow2_cache_table_release(c, i, 1);
+    }
+}
+
 static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *t;
+    bool miss = false;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -340,29 +501,42 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        c->hits++;
+        t = &c->entries[i];
+        if (t->ref == 0) {
+            QTAILQ_REMOVE(&c->lru, t, lru_entry);
         }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    /*
+     * Prefer an empty entry unless the cache is at its limit; go over the
+     * limit rather than fail if all tables are in use.
+     */
+    t = NULL;
+    if (c->size - c->nb_free < qatomic_read(&c->limit)) {
+        t = QTAILQ_FIRST(&c->free);
+    }
+    if (!t) {
+        t = QTAILQ_FIRST(&c->lru);
+    }
+    if (!t) {
+        t = QTAILQ_FIRST(&c->free);
+    }
+    if (!t) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    c->misses++;
+    if (c->pool) {
+        qatomic_set(&c->pool_misses, c->pool_misses + 1);
+    }
+    i = t - c->entries;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -373,7 +547,13 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (t->offset) {
+        c->evictions++;
+        qcow2_cache_set_offset(c, i, 0);
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    } else {
+        qcow2_cache_free_remove(c, t);
+    }
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -382,17 +562,27 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         ret = bdrv_pread(bs->file, offset, c->table_size,
                          qcow2_cache_get_table_addr(c, i), 0);
         if (ret < 0) {
+            t->lru_counter = 0;
+            qcow2_cache_free_insert(c, t);
             return ret;
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
+    miss = true;
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
     *table = qcow2_cache_get_table_addr(c, i);
 
+    if (miss) {
+        if (c->pool) {
+            qcow2_cache_pool_maybe_rebalance(c->pool);
+        }
+        qcow2_cache_shrink(bs, c);
+    }
+
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
 
@@ -419,7 +609,9 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
     *table = NULL;
 
     if (c->entries[i].ref == 0) {
+        assert(c->entries[i].offset != 0);
         c->entries[i].lru_counter = ++c->lru_counter;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -434,25 +626,272 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
 {
     int i = qcow2_cache_get_table_idx(c, table);
 
-    assert(c->entries[i].ref == 0);
-
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_clear(c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+Qcow2CacheStats *qcow2_cache_get_stats(Qcow2Cache *c)
+{
+    Qcow2CacheStats *stats = g_new(Qcow2CacheStats, 1);
+
+    *stats = (Qcow2CacheStats) {
+        .hits = c->hits,
+        .misses = c->misses,
+        .evictions = c->evictions,
+    };
+    return stats;
+}
+
+/*
+ * Distribute the budget of @pool among its caches.  Every cache gets at
+ * least MIN_L2_CACHE_SIZE entries; the rest is shared in proportion to the
+ * misses since the last round, capped at what each cache can hold.
+ * Called with pool->lock held.
+ */
+static void qcow2_cache_pool_rebalance_locked(Qcow2CachePool *pool)
+{
+    g_autofree uint64_t *weight = NULL;
+    g_autofree uint64_t *target = NULL;
+    g_autofree bool *capped = NULL;
+    uint64_t spare = pool->size;
+    uint64_t current = 0;
+    Qcow2Cache *c;
+    bool changed;
+    int n = 0, i;
+
+    QLIST_FOREACH(c, &pool->caches, pool_entry) {
+        n++;
+    }
+    if (!n) {
+        return;
+    }
+
+    weight = g_new(uint64_t, n);
+    target = g_new(uint64_t, n);
+    capped = g_new0(bool, n);
+
+    i = 0;
+    QLIST_FOREACH(c, &pool->caches, pool_entry) {
+        unsigned misses = qatomic_read(&c->pool_misses);
+        uint64_t min = (uint64_t) MIN_L2_CACHE_SIZE * c->table_size;
+
+        /* Idle caches still get a small share */
+        weight[i] = (unsigned) (misses - c->pool_last_misses) + 1;
+        c->pool_last_misses = misses;
+        target[i] = min;
+        spare -= MIN(spare, min);
+        current += (uint64_t) qatomic_read(&c->limit) * c->table_size;
+        i++;
+    }
+
+    /* Water-filling: hand out the spare memory, redo it when a cache fills */
+    do {
+        uint64_t total_weight = 0, left = spare;
+
+        changed = false;
+        for (i = 0; i < n; i++) {
+            if (!capped[i]) {
+                total_weight += weight[i];
+            }
+        }
+
+        i = 0;
+        QLIST_FOREACH(c, &pool->caches, pool_entry) {
+            uint64_t min = (uint64_t) MIN_L2_CACHE_SIZE * c->table_size;
+            uint64_t max = (uint64_t) c->size * c->table_size;
+            uint64_t share;
+
+            if (!capped[i]) {
+                share = total_weight ?
+                        (uint64_t) ((double) spare * weight[i] / total_weight) :
+                        0;
+                if (min + share >= max) {
+                    target[i] = MAX(min, max);
+                    capped[i] = true;
+                    left -= MIN(left, target[i] - min);
+                    changed = true;
+                } else {
+                    target[i] = min + share;
+                }
+            }
+            i++;
+        }
+        spare = left;
+    } while (changed);
+
+    i = 0;
+    QLIST_FOREACH(c, &pool->caches, pool_entry) {
+        uint64_t entries = target[i] / c->table_size;
+        uint64_t old = qatomic_read(&c->limit);
+        int limit;
+
+        /*
+         * Smooth out short bursts unless the budget has shrunk.  Round
+         * toward the target, or a limit just below it would never move.
+         */
+        if (current <= pool->size) {
+            entries = entries > old ? DIV_ROUND_UP(entries + old, 2) :
+                                      (entries + old) / 2;
+        }
+        limit = MAX(MIN(entries, c->size), MIN_L2_CACHE_SIZE);
+        qatomic_set(&c->limit, MIN(limit, c->size));
+        i++;
+    }
+
+    pool->last_rebalance_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
+
+static void qcow2_cache_pool_maybe_rebalance(Qcow2CachePool *pool)
+{
+    /* If someone else holds the lock, they are at it already */
+    if (qemu_mutex_trylock(&pool->lock) != 0) {
+        return;
+    }
+    if (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - pool->last_rebalance_ns >=
+        QCOW2_CACHE_POOL_INTERVAL_NS) {
+        qcow2_cache_pool_rebalance_locked(pool);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void qcow2_cache_set_pool(Qcow2Cache *c, Qcow2CachePool *pool)
+{
+    Qcow2CachePool *old = c->pool;
+
+    if (old == pool) {
+        return;
+    }
+
+    if (old) {
+        qemu_mutex_lock(&old->lock);
+        QLIST_REMOVE(c, pool_entry);
+        c->pool = NULL;
+        qatomic_set(&c->limit, c->size);
+        qcow2_cache_pool_rebalance_locked(old);
+        qemu_mutex_unlock(&old->lock);
+        object_unref(OBJECT(old));
+    }
+
+    if (pool) {
+        object_ref(OBJECT(pool));
+        qemu_mutex_lock(&pool->lock);
+        c->pool = pool;
+        c->pool_last_misses = c->pool_misses;
+        /* Start small, the next rounds will grow the cache if it misses */
+        qatomic_set(&c->limit, MIN_L2_CACHE_SIZE);
+        QLIST_INSERT_HEAD(&pool->caches, c, pool_entry);
+        qcow2_cache_pool_rebalance_locked(pool);
+        qemu_mutex_unlock(&pool->lock);
+    }
+}
+
+Qcow2CachePool *qcow2_cache_pool_find(const char *id, Error **errp)
+{
+    Object *obj = object_resolve_path_component(object_get_objects_root(), id);
+
+    if (!obj || !object_dynamic_cast(obj, TYPE_QCOW2_CACHE_POOL)) {
+        error_setg(errp, "'%s' is not a " TYPE_QCOW2_CACHE_POOL " object", id);
+        return NULL;
+    }
+    return QCOW2_CACHE_POOL(obj);
+}
+
+uint64_t qcow2_cache_pool_get_size(Qcow2CachePool *pool)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+    return pool->size;
+}
+
+static void qcow2_cache_pool_get_size_prop(Object *obj, Visitor *v,
+                                           const char *name, void *opaque,
+                                           Error **errp)
+{
+    uint64_t value = qcow2_cache_pool_get_size(QCOW2_CACHE_POOL(obj));
+
+    visit_type_size(v, name, &value, errp);
+}
+
+static void qcow2_cache_pool_set_size_prop(Object *obj, Visitor *v,
+                                           const char *name, void *opaque,
+                                           Error **errp)
+{
+    Qcow2CachePool *pool = QCOW2_CACHE_POOL(obj);
+    uint64_t value;
+
+    if (!visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    pool->size = value;
+    qcow2_cache_pool_rebalance_locked(pool);
+    qemu_mutex_unlock(&pool->lock);
+}
+
+static void qcow2_cache_pool_init(Object *obj)
+{
+    Qcow2CachePool *pool = QCOW2_CACHE_POOL(obj);
+
+    qemu_mutex_init(&pool->lock);
+    QLIST_INIT(&pool->caches);
+    pool->size = DEFAULT_L2_CACHE_MAX_SIZE;
+}
+
+static void qcow2_cache_pool_finalize(Object *obj)
+{
+    Qcow2CachePool *pool = QCOW2_CACHE_POOL(obj);
+
+    assert(QLIST_EMPTY(&pool->caches));
+    qemu_mutex_destroy(&pool->lock);
+}
+
+static bool qcow2_cache_pool_can_be_deleted(UserCreatable *uc)
+{
+    /* Every member cache holds a reference */
+    return OBJECT(uc)->ref == 1;
+}
+
+static void qcow2_cache_pool_class_init(ObjectClass *klass, void *class_data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
+
+    ucc->can_be_deleted = qcow2_cache_pool_can_be_deleted;
+
+    object_class_property_add(klass, "size", "size",
+                              qcow2_cache_pool_get_size_prop,
+                              qcow2_cache_pool_set_size_prop,
+                              NULL, NULL);
+    object_class_property_set_description(klass, "size",
+            "Memory shared by the L2 caches of all member nodes");
+}
+
+static const TypeInfo qcow2_cache_pool_info = {
+    .name = TYPE_QCOW2_CACHE_POOL,
+    .parent = TYPE_OBJECT,
+    .class_init = qcow2_cache_pool_class_init,
+    .instance_size = sizeof(Qcow2CachePool),
+    .instance_init = qcow2_cache_pool_init,
+    .instance_finalize = qcow2_cache_pool_finalize,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    },
+};
+
+static void qcow2_cache_pool_register_types(void)
+{
+    type_register_static(&qcow2_cache_pool_info);
+}
+
+type_init(qcow2_cache_pool_register_types);
@@ -33,6 +33,11 @@
 #include <zstd_errors.h>
 #endif
 
+#ifdef CONFIG_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
 #include "qcow2.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
@@ -45,7 +50,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -66,18 +71,44 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
  * Compression
  */
 
+/* @level is only used for compression, 0 selects the default level */
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     int level);
 typedef struct Qcow2CompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
+    int level;
     ssize_t ret;
 
     Qcow2CompressFunc func;
 } Qcow2CompressData;
 
+/*
+ * qcow2_compression_level_max()
+ *
+ * Returns: the highest compression level supported by @type
+ */
+int qcow2_compression_level_max(Qcow2CompressionType type)
+{
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return Z_BEST_COMPRESSION;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return ZSTD_maxCLevel();
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        return LZ4HC_CLEVEL_MAX;
+#endif
+    default:
+        abort();
+    }
+}
+
 /*
  * qcow2_zlib_compress()
  *
@@ -85,21 +116,25 @@ typedef struct Qcow2CompressData {
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - zlib compression level, 0 for the zlib default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     z_stream strm;
 
-    /* best compression, small window, no zlib header */
+    /* small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-                       -12, 9, Z_DEFAULT_STRATEGY);
+    ret = deflateInit2(&strm,
+                       level ? MIN(level, Z_BEST_COMPRESSION)
+                             : Z_DEFAULT_COMPRESSION,
+                       Z_DEFLATED, -12, 9, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK) {
         return -EIO;
     }
@@ -138,7 +173,8 @@ static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
  *          -EIO on fail
  */
 static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     int ret;
     z_stream strm;
@@ -180,13 +216,15 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - zstd compression level, 0 for the zstd default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     size_t zstd_ret;
@@ -205,6 +243,12 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
     if (!cctx) {
         return -EIO;
     }
+    if (level &&
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                            MIN(level, ZSTD_maxCLevel())))) {
+        ret = -EIO;
+        goto out;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -254,7 +298,8 @@ out:
  *          -EIO on any error
  */
 static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     size_t zstd_ret = 0;
     ssize_t ret = 0;
@@ -325,25 +370,112 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
 }
 #endif
 
+#ifdef CONFIG_LZ4
+
+/*
+ * An lz4 block must be decompressed with its exact size, but qcow2 only
+ * knows the compressed size with sector granularity.  So the block is
+ * preceded by its size as a big-endian 32-bit value.
+ */
+#define QCOW2_LZ4_HEADER_SIZE 4
+
+/*
+ * qcow2_lz4_compress()
+ *
+ * Compress @src_size bytes of data using lz4 compression method
+ *
+ * @dest - destination buffer, @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ * @level - lz4hc compression level, 0 for the fast lz4 compressor
+ *
+ * Returns: compressed size on success
+ *          -ENOMEM destination buffer is not enough to store compressed data
+ */
+static ssize_t qcow2_lz4_compress(void *dest, size_t dest_size,
+                                  const void *src, size_t src_size,
+                                  int level)
+{
+    char *block = (char *)dest + QCOW2_LZ4_HEADER_SIZE;
+    int ret;
+
+    if (dest_size <= QCOW2_LZ4_HEADER_SIZE) {
+        return -ENOMEM;
+    }
+    dest_size = MIN(dest_size - QCOW2_LZ4_HEADER_SIZE, INT_MAX);
+
+    if (level) {
+        ret = LZ4_compress_HC(src, block, src_size, dest_size,
+                              MIN(level, LZ4HC_CLEVEL_MAX));
+    } else {
+        ret = LZ4_compress_default(src, block, src_size, dest_size);
+    }
+    /* lz4 does not tell why it failed, but the only reason is lack of space */
+    if (ret <= 0) {
+        return -ENOMEM;
+    }
+
+    stl_be_p(dest, ret);
+    return QCOW2_LZ4_HEADER_SIZE + ret;
+}
+
+/*
+ * qcow2_lz4_decompress()
+ *
+ * Decompress some data (not more than @src_size bytes) to produce exactly
+ * @dest_size bytes using lz4 compression method
+ *
+ * @dest - destination buffer, @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: 0 on success
+ *          -EIO on any error
+ */
+static ssize_t qcow2_lz4_decompress(void *dest, size_t dest_size,
+                                    const void *src, size_t src_size,
+                                    int level)
+{
+    uint32_t block_size;
+
+    if (src_size < QCOW2_LZ4_HEADER_SIZE) {
+        return -EIO;
+    }
+
+    block_size = ldl_be_p(src);
+    if (block_size > src_size - QCOW2_LZ4_HEADER_SIZE ||
+        block_size > INT_MAX || dest_size > INT_MAX) {
+        return -EIO;
+    }
+
+    if (LZ4_decompress_safe((const char *)src + QCOW2_LZ4_HEADER_SIZE, dest,
+                            block_size, dest_size) != dest_size) {
+        return -EIO;
+    }
+
+    return 0;
+}
+#endif
+
 static int qcow2_compress_pool_func(void *opaque)
 {
     Qcow2CompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
-                           data->src, data->src_size);
+                           data->src, data->src_size, data->level);
 
     return 0;
 }
 
 static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                     const void *src, size_t src_size, Qcow2CompressFunc func)
+                     const void *src, size_t src_size, int level,
+                     Qcow2CompressFunc func)
 {
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
         .src = src,
         .src_size = src_size,
+        .level = level,
         .func = func,
     };
 
@@ -380,12 +512,18 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
     case QCOW2_COMPRESSION_TYPE_ZSTD:
         fn = qcow2_zstd_compress;
         break;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        fn = qcow2_lz4_compress;
+        break;
 #endif
     default:
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size,
+                                s->compression_level, fn);
 }
 
 /*
@@ -417,12 +555,17 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
     case QCOW2_COMPRESSION_TYPE_ZSTD:
         fn = qcow2_zstd_decompress;
         break;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        fn = qcow2_lz4_decompress;
+        break;
 #endif
     default:
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, 0, fn);
 }
 
 
@@ -467,6 +610,7 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
         .func = func,
     };
     uint64_t sector_size;
+    int ret;
 
     assert(s->crypto);
 
@@ -475,7 +619,29 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    if (len == 0) {
+        return 0;
+    }
+
+    /*
+     * s->crypto has QCOW2_CRYPTO_THREADS ciphers, which can be fewer than
+     * worker-threads allows.
+     */
+    qemu_co_mutex_lock(&s->lock);
+    while (s->nb_crypto_threads >= QCOW2_CRYPTO_THREADS) {
+        qemu_co_queue_wait(&s->crypto_task_queue, &s->lock);
+    }
+    s->nb_crypto_threads++;
+    qemu_co_mutex_unlock(&s->lock);
+
+    ret = qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+
+    qemu_co_mutex_lock(&s->lock);
+    s->nb_crypto_threads--;
+    qemu_co_queue_next(&s->crypto_task_queue);
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
 }
 
 /*
@@ -318,7 +318,7 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, QCOW2_MAX_THREADS, errp);
+                                           bs, cflags, QCOW2_CRYPTO_THREADS, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
@@ -694,8 +694,11 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_CACHE_SIZE,
     QCOW2_OPT_L2_CACHE_SIZE,
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
+    QCOW2_OPT_L2_CACHE_POOL,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_WORKER_THREADS,
+    QCOW2_OPT_COMPRESSION_LEVEL,
     NULL
 };
 
@@ -797,6 +800,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "Size of each entry in the L2 cache",
         },
+        {
+            .name = QCOW2_OPT_L2_CACHE_POOL,
+            .type = QEMU_OPT_STRING,
+            .help = "ID of a qcow2-cache-pool object to share the L2 cache "
+                    "memory with",
+        },
         {
             .name = QCOW2_OPT_REFCOUNT_CACHE_SIZE,
             .type = QEMU_OPT_SIZE,
@@ -807,6 +816,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_WORKER_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of concurrent compression, decompression "
+                    "and encryption tasks",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSION_LEVEL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Compression level for newly written compressed clusters "
+                    "(0 selects the default of the compression type)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -869,6 +890,7 @@ static void qcow2_attach_aio_context(BlockDriverState *bs,
 }
 
 static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
+                             Qcow2CachePool *pool,
                              uint64_t *l2_cache_size,
                              uint64_t *l2_cache_entry_size,
                              uint64_t *refcount_cache_size, Error **errp)
@@ -891,7 +913,9 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     l2_cache_entry_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_ENTRY_SIZE);
 
     combined_cache_size = qemu_opt_get_size(opts, QCOW2_OPT_CACHE_SIZE, 0);
+    /* A pooled cache can grow as far as the pool lets it */
     l2_cache_max_setting = qemu_opt_get_size(opts, QCOW2_OPT_L2_CACHE_SIZE,
+                                             pool ? max_l2_cache :
                                              DEFAULT_L2_CACHE_MAX_SIZE);
     *refcount_cache_size = qemu_opt_get_size(opts,
                                              QCOW2_OPT_REFCOUNT_CACHE_SIZE, 0);
@@ -900,6 +924,9 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
         opts, QCOW2_OPT_L2_CACHE_ENTRY_SIZE, s->cluster_size);
 
     *l2_cache_size = MIN(max_l2_cache, l2_cache_max_setting);
+    if (pool) {
+        *l2_cache_size = MIN(*l2_cache_size, qcow2_cache_pool_get_size(pool));
+    }
 
     if (combined_cache_size_set) {
         if (l2_cache_size_set && refcount_cache_size_set) {
@@ -939,9 +966,10 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     /*
      * If the L2 cache is not enough to cover the whole disk then
      * default to 4KB entries. Smaller entries reduce the cost of
-     * loads and evictions and increase I/O performance.
+     * loads and evictions and increase I/O performance.  A pooled
+     * cache usually gets less than its maximum size.
      */
-    if (*l2_cache_size < max_l2_cache && !l2_cache_entry_size_set) {
+    if ((pool || *l2_cache_size < max_l2_cache) && !l2_cache_entry_size_set) {
         *l2_cache_entry_size = MIN(s->cluster_size, 4096);
     }
 
@@ -968,6 +996,8 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    int max_threads;
+    int compression_level;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -981,6 +1011,8 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    const char *l2_cache_pool;
+    Qcow2CachePool *pool = NULL;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -995,8 +1027,17 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    l2_cache_pool = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_POOL);
+    if (l2_cache_pool) {
+        pool = qcow2_cache_pool_find(l2_cache_pool, errp);
+        if (!pool) {
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
+
     /* get L2 table/refcount block cache size from command line options */
-    if (!read_cache_sizes(bs, opts, &l2_cache_size, &l2_cache_entry_size,
+    if (!read_cache_sizes(bs, opts, pool, &l2_cache_size, &l2_cache_entry_size,
                           &refcount_cache_size, errp)) {
         ret = -EINVAL;
         goto fail;
@@ -1050,6 +1091,9 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         ret = -ENOMEM;
         goto fail;
     }
+    if (pool) {
+        qcow2_cache_set_pool(r->l2_table_cache, pool);
+    }
 
     /* New interval for cache cleanup timer */
     r->cache_clean_interval =
@@ -1069,6 +1113,28 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->max_threads = qemu_opt_get_number(opts, QCOW2_OPT_WORKER_THREADS,
+                                         QCOW2_DEFAULT_THREADS);
+    if (r->max_threads < 1 || r->max_threads > QCOW2_MAX_THREADS) {
+        error_setg(errp, QCOW2_OPT_WORKER_THREADS " must be between 1 and %d",
+                   QCOW2_MAX_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->compression_level = qemu_opt_get_number(opts,
+                                               QCOW2_OPT_COMPRESSION_LEVEL, 0);
+    if (r->compression_level < 0 ||
+        r->compression_level >
+        qcow2_compression_level_max(s->compression_type)) {
+        error_setg(errp, QCOW2_OPT_COMPRESSION_LEVEL " must be between 0 and "
+                   "%d for compression type '%s'",
+                   qcow2_compression_level_max(s->compression_type),
+                   Qcow2CompressionType_str(s->compression_type));
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1224,6 +1290,9 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->max_threads = r->max_threads;
+    s->compression_level = r->compression_level;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1256,12 +1325,61 @@ static int qcow2_update_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+/*
+ * Qcow2CompressionType only has the types QEMU was built with, so its
+ * values do not necessarily match the ones of the header field.
+ */
+static uint8_t compression_type_to_header(Qcow2CompressionType type)
+{
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return QCOW2_HEADER_COMPRESSION_ZLIB;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return QCOW2_HEADER_COMPRESSION_ZSTD;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
+        return QCOW2_HEADER_COMPRESSION_LZ4;
+#endif
+    default:
+        abort();
+    }
+}
+
+static int compression_type_from_header(uint8_t value,
+                                        Qcow2CompressionType *type,
+                                        Error **errp)
+{
+    switch (value) {
+    case QCOW2_HEADER_COMPRESSION_ZLIB:
+        *type = QCOW2_COMPRESSION_TYPE_ZLIB;
+        return 0;
+#ifdef CONFIG_ZSTD
+    case QCOW2_HEADER_COMPRESSION_ZSTD:
+        *type = QCOW2_COMPRESSION_TYPE_ZSTD;
+        return 0;
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_HEADER_COMPRESSION_LZ4:
+        *type = QCOW2_COMPRESSION_TYPE_LZ4;
+        return 0;
+#endif
+    default:
+        error_setg(errp, "qcow2: unknown compression type: %u", value);
+        return -ENOTSUP;
+    }
+}
+
 static int validate_compression_type(BDRVQcow2State *s, Error **errp)
 {
     switch (s->compression_type) {
     case QCOW2_COMPRESSION_TYPE_ZLIB:
 #ifdef CONFIG_ZSTD
     case QCOW2_COMPRESSION_TYPE_ZSTD:
+#endif
+#ifdef CONFIG_LZ4
+    case QCOW2_COMPRESSION_TYPE_LZ4:
 #endif
         break;
 
@@ -1416,7 +1534,11 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
      * the only valid (default) compression type in that case
      */
     if (header.header_length > offsetof(QCowHeader, compression_type)) {
-        s->compression_type = header.compression_type;
+        ret = compression_type_from_header(header.compression_type,
+                                           &s->compression_type, errp);
+        if (ret) {
+            goto fail;
+        }
     } else {
         s->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
     }
@@ -1675,7 +1797,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            NULL, NULL, cflags,
-                                           QCOW2_MAX_THREADS, errp);
+                                           QCOW2_CRYPTO_THREADS, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1847,6 +1969,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qemu_co_queue_init(&s->crypto_task_queue);
 
     return ret;
 
@@ -2900,7 +3023,8 @@ int qcow2_update_header(BlockDriverState *bs)
         .autoclear_features     = cpu_to_be64(s->autoclear_features),
         .refcount_order         = cpu_to_be32(s->refcount_order),
         .header_length          = cpu_to_be32(header_length),
-        .compression_type       = s->compression_type,
+        .compression_type       =
+            compression_type_to_header(s->compression_type),
     };
 
     /* For older versions, write a shorter header */
@@ -3448,7 +3572,7 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
     int refcount_order;
     uint64_t *refcount_table;
     int ret;
-    uint8_t compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+    Qcow2CompressionType compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
 
     assert(create_options->driver == BLOCKDEV_DRIVER_QCOW2);
     qcow2_opts = &create_options->u.qcow2;
@@ -3618,6 +3742,10 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
 #ifdef CONFIG_ZSTD
         case QCOW2_COMPRESSION_TYPE_ZSTD:
             break;
+#endif
+#ifdef CONFIG_LZ4
+        case QCOW2_COMPRESSION_TYPE_LZ4:
+            break;
 #endif
         default:
             error_setg(errp, "Unknown compression type");
@@ -3650,7 +3778,8 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         .refcount_table_clusters    = cpu_to_be32(1),
         .refcount_order             = cpu_to_be32(refcount_order),
         /* don't deal with endianness since compression_type is 1 byte long */
-        .compression_type           = compression_type,
+        .compression_type           =
+            compression_type_to_header(compression_type),
         .header_length              = cpu_to_be32(sizeof(*header)),
     };
 
@@ -4700,7 +4829,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            /* Keep all worker threads busy compressing */
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS, s->max_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -5231,6 +5361,20 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2 = (BlockStatsSpecificQcow2) {
+        .l2_cache = qcow2_cache_get_stats(s->l2_table_cache),
+        .refcount_cache = qcow2_cache_get_stats(s->refcount_block_cache),
+    };
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -6078,6 +6222,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -147,8 +147,11 @@
 #define QCOW2_OPT_CACHE_SIZE "cache-size"
 #define QCOW2_OPT_L2_CACHE_SIZE "l2-cache-size"
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
+#define QCOW2_OPT_L2_CACHE_POOL "l2-cache-pool"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_WORKER_THREADS "worker-threads"
+#define QCOW2_OPT_COMPRESSION_LEVEL "compression-level"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -174,7 +177,7 @@ typedef struct QCowHeader {
     uint32_t header_length;
 
     /* Additional fields */
-    uint8_t compression_type;
+    uint8_t compression_type; /* QCOW2_HEADER_COMPRESSION_* */
 
     /* header must be a multiple of 8 */
     uint8_t padding[7];
@@ -230,6 +233,9 @@ typedef struct QCowSnapshot {
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
+#define TYPE_QCOW2_CACHE_POOL "qcow2-cache-pool"
+typedef struct Qcow2CachePool Qcow2CachePool;
+
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
     uint64_t length;
@@ -321,7 +327,18 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/* Values of the compression_type header field */
+enum {
+    QCOW2_HEADER_COMPRESSION_ZLIB   = 0,
+    QCOW2_HEADER_COMPRESSION_ZSTD   = 1,
+    QCOW2_HEADER_COMPRESSION_LZ4    = 2,
+};
+
+/* Default and maximum number of concurrent worker thread tasks per image */
+#define QCOW2_DEFAULT_THREADS 4
+#define QCOW2_MAX_THREADS 64
+/* Cipher instances per encrypted image, bounds concurrent encryption tasks */
+#define QCOW2_CRYPTO_THREADS 4
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -407,6 +424,9 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+    CoQueue crypto_task_queue;
+    int nb_crypto_threads;
 
     BdrvChild *data_file;
 
@@ -419,6 +439,8 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+    /* 0 means the default level of the compression type */
+    int compression_level;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -977,6 +999,11 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+Qcow2CacheStats *qcow2_cache_get_stats(Qcow2Cache *c);
+
+Qcow2CachePool *qcow2_cache_pool_find(const char *id, Error **errp);
+uint64_t qcow2_cache_pool_get_size(Qcow2CachePool *pool);
+void qcow2_cache_set_pool(Qcow2Cache *c, Qcow2CachePool *pool);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
@@ -1002,6 +1029,7 @@ bool qcow2_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 uint64_t qcow2_get_persistent_dirty_bitmap_size(BlockDriverState *bs,
                                                 uint32_t cluster_size);
 
+int qcow2_compression_level_max(Qcow2CompressionType type);
 ssize_t coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                   const void *src, size_t src_size);
@@ -268,6 +268,11 @@ void qmp_nbd_server_remove(const char *name,
     qmp_block_export_del(name, has_mode, mode, errp);
 }
 
+NbdServerClientInfoList *qmp_query_nbd_server_clients(Error **errp)
+{
+    return nbd_query_clients();
+}
+
 void qmp_nbd_server_stop(Error **errp)
 {
     if (!nbd_server) {
@@ -32,6 +32,9 @@ static void event_loop_base_instance_init(Object *obj)
 static EventLoopBaseParamInfo aio_max_batch_info = {
     "aio-max-batch", offsetof(EventLoopBase, aio_max_batch),
 };
+static EventLoopBaseParamInfo aio_sqpoll_idle_ms_info = {
+    "aio-sqpoll-idle-ms", offsetof(EventLoopBase, aio_sqpoll_idle_ms),
+};
 static EventLoopBaseParamInfo thread_pool_min_info = {
     "thread-pool-min", offsetof(EventLoopBase, thread_pool_min),
 };
@@ -109,6 +112,10 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &aio_max_batch_info);
+    object_class_property_add(klass, "aio-sqpoll-idle-ms", "int",
+                              event_loop_base_get_param,
+                              event_loop_base_set_param,
+                              NULL, &aio_sqpoll_idle_ms_info);
     object_class_property_add(klass, "thread-pool-min", "int",
                               event_loop_base_get_param,
                               event_loop_base_set_param,
@@ -43,6 +43,15 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * With iothread-vq-mapping each virtqueue is polled from its own
+     * AioContext.  ctx stays the BlockBackend's home context; requests
+     * submitted from the other contexts are handed over to it by the block
+     * layer, which serializes them under that context's lock.
+     */
+    AioContext **vq_aio_context;
+    GList *mapped_iothreads;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -80,6 +89,55 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+/*
+ * Fill in vq_aio_context[] from an iothread-vq-mapping list that has already
+ * been validated at realize time.  Returns the IOThread whose AioContext
+ * becomes the BlockBackend's home context.
+ */
+static IOThread *apply_vq_mapping(VirtIOBlockDataPlane *s,
+                                  IOThreadVirtQueueMappingList *list)
+{
+    unsigned nvqs = s->conf->num_queues;
+    unsigned num_iothreads = 0;
+    IOThread *first = NULL;
+    unsigned cur_iothread = 0;
+
+    for (IOThreadVirtQueueMappingList *node = list; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    for (IOThreadVirtQueueMappingList *node = list; node; node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value->iothread);
+        AioContext *ctx = iothread_get_aio_context(iothread);
+
+        /* Released in virtio_blk_data_plane_destroy() */
+        object_ref(OBJECT(iothread));
+        s->mapped_iothreads = g_list_append(s->mapped_iothreads, iothread);
+        if (!first) {
+            first = iothread;
+        }
+
+        if (node->value->vqs) {
+            uint16List *vq;
+
+            /* Explicit vq:IOThread assignment */
+            for (vq = node->value->vqs; vq; vq = vq->next) {
+                assert(vq->value < nvqs);
+                s->vq_aio_context[vq->value] = ctx;
+            }
+        } else {
+            /* Round-robin vq:IOThread assignment */
+            for (unsigned i = cur_iothread; i < nvqs; i += num_iothreads) {
+                s->vq_aio_context[i] = ctx;
+            }
+        }
+
+        cur_iothread++;
+    }
+
+    return first;
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -91,7 +149,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread || conf->iothread_vq_mapping_list) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -119,14 +177,27 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+
+    if (conf->iothread_vq_mapping_list) {
+        IOThread *home = apply_vq_mapping(s, conf->iothread_vq_mapping_list);
 
-    if (conf->iothread) {
+        s->ctx = iothread_get_aio_context(home);
+    } else if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    if (!conf->iothread_vq_mapping_list) {
+        unsigned i;
+
+        for (i = 0; i < conf->num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
+    }
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -151,6 +222,8 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    g_list_free_full(s->mapped_iothreads, (GDestroyNotify)object_unref);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -248,13 +321,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+        aio_context_acquire(ctx);
+        virtio_queue_aio_attach_host_notifier(vq, ctx);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -285,18 +359,13 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
 /* Stop notifications for new requests from guest.
  *
- * Context: BH in IOThread
+ * Context: BH in the virtqueue's IOThread
  */
-static void virtio_blk_data_plane_stop_bh(void *opaque)
+static void virtio_blk_data_plane_stop_vq_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
-
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+    VirtQueue *vq = opaque;
 
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
-    }
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 }
 
 /* Context: QEMU global mutex held */
@@ -322,8 +391,16 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_vq_bh, vq);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
@@ -245,6 +245,7 @@ struct AioContext {
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    int64_t aio_sqpoll_idle_ms; /* io_uring SQPOLL thread idle time, 0 = off */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -776,9 +777,13 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  * @ctx: the aio context
  * @max_batch: maximum number of requests in a batch, 0 means that the
  *             engine will use its default
+ * @sqpoll_idle_ms: if non-zero, the Linux io_uring engine uses a kernel
+ *                  submission queue polling thread that sleeps after this
+ *                  many milliseconds without work.  Only affects rings set
+ *                  up after the call.
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
-                                Error **errp);
+                                int64_t sqpoll_idle_ms, Error **errp);
 
 /**
  * aio_context_set_thread_pool_params:
@@ -255,6 +255,9 @@ bool co_wrapper bdrv_can_store_new_dirty_bitmap(BlockDriverState *bs,
  *                               recursion.
  *         BDRV_REQ_NO_SERIALISING - do not serialize with other overlapping
  *                                   requests currently in flight.
+ *         BDRV_REQ_NO_FALLBACK - (@write_flags only) fail with -ENOTSUP
+ *                                unless the range can be shared with @src
+ *                                (e.g. reflinked) instead of copied.
  *
  * Returns: 0 if succeeded; negative error code if failed.
  **/
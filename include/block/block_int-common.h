@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/throttle.h"
 #include "qemu/rcu.h"
@@ -991,21 +992,37 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * Upper bound for the number of data regions in a block-status cache, so
+ * that a heavily fragmented image cannot make it grow without limit.
+ */
+#define BDRV_BSC_MAX_ENTRIES 1024
+
+/*
+ * One data region in the block-status cache.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * @node: The region [start, last] in the interval tree; the region is not
+ *        necessarily followed by a zeroed region
+ * @next: Link in the list of regions, least recently used first
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
+typedef struct BdrvBlockStatusCacheEntry {
+    IntervalTreeNode node;
+    QTAILQ_ENTRY(BdrvBlockStatusCacheEntry) next;
+} BdrvBlockStatusCacheEntry;
 
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+/*
+ * Allows bdrv_co_block_status() to cache the data regions of a protocol
+ * node.  Regions never overlap or touch, adjacent ones are merged.
+ *
+ * @lock: Protects all other fields
+ * @root: Interval tree of the BdrvBlockStatusCacheEntry regions
+ * @entries: The same regions in LRU order, for eviction
+ * @nr_entries: Length of @entries
+ */
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    IntervalTreeRoot root;
+    QTAILQ_HEAD(, BdrvBlockStatusCacheEntry) entries;
+    unsigned int nr_entries;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1197,9 +1214,7 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
+    /* Non-NULL until the node is closed */
     BdrvBlockStatusCache *block_status_cache;
 };
 
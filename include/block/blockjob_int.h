@@ -68,6 +68,12 @@ struct BlockJobDriver {
     void (*attached_aio_context)(BlockJob *job, AioContext *new_context);
 
     void (*set_speed)(BlockJob *job, int64_t speed);
+
+    /*
+     * Fill in the job type specific members of @info for query-block-jobs.
+     * Called with the job lock held.
+     */
+    void (*query)(BlockJob *job, BlockJobInfo *info);
 };
 
 /*
@@ -17,6 +17,7 @@
 #define QEMU_RAW_AIO_H
 
 #include "block/aio.h"
+#include "block/block-common.h"
 #include "qemu/coroutine.h"
 #include "qemu/iov.h"
 
@@ -62,10 +63,16 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s,
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(int64_t sqpoll_idle_ms, Error **errp);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                uint64_t offset, QEMUIOVector *qiov, int type);
+                                  int fixed_file, uint64_t offset,
+                                  QEMUIOVector *qiov, int type,
+                                  BdrvRequestFlags flags);
+int luring_register_file(LuringState *s, int fd);
+void luring_unregister_file(LuringState *s, int slot);
+void luring_register_buf(LuringState *s, void *host, size_t size);
+void luring_unregister_buf(LuringState *s, void *host, size_t size);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
@@ -65,6 +65,12 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * Location in the page store of each page, when the migration source
+     * uses one.  Protected by the global ram_state.bitmap_mutex.
+     */
+    uint64_t *store_map;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
@@ -77,6 +77,7 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @trace_jmps: Number of jumps followed by translator_trace_follow().
  *
  * Architecture-agnostic disassembly context.
  */
@@ -88,6 +89,7 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    int trace_jmps;
     void *host_addr[2];
 } DisasContextBase;
 
@@ -114,6 +116,9 @@ typedef struct DisasContextBase {
  *
  * @disas_log:
  *      Print instruction disassembly to log.
+ * @can_trace:
+ *      The target calls translator_trace_follow() for its direct jumps, so
+ *      hot TBs are worth retranslating with CF_TRACE.
  */
 typedef struct TranslatorOps {
     void (*init_disas_context)(DisasContextBase *db, CPUState *cpu);
@@ -122,6 +127,7 @@ typedef struct TranslatorOps {
     void (*translate_insn)(DisasContextBase *db, CPUState *cpu);
     void (*tb_stop)(DisasContextBase *db, CPUState *cpu);
     void (*disas_log)(const DisasContextBase *db, CPUState *cpu, FILE *f);
+    bool can_trace;
 } TranslatorOps;
 
 /**
@@ -162,6 +168,26 @@ void translator_loop_temp_check(DisasContextBase *db);
  */
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
 
+/**
+ * translator_trace_follow
+ * @db: Disassembly context
+ * @next: address of the instruction following the jump
+ * @dest: target pc of the jump
+ *
+ * With "-accel tcg,hot-threshold=N", a TB that has run N times is
+ * retranslated with CF_TRACE.  Such a TB may continue translating at the
+ * destination of an unconditional direct jump instead of ending, so that
+ * the blocks along the hot path become a single TB and the optimizer and
+ * the target's own lazy state (e.g. condition codes) span all of them.
+ *
+ * Return true if the caller may do so: it must then emit no exit from
+ * the TB and simply continue decoding at @dest.  Only forward jumps
+ * within the page of the TB are followed, which keeps
+ * [pc_first, pc_next) covering every byte that was translated.
+ */
+bool translator_trace_follow(DisasContextBase *db, target_ulong next,
+                             target_ulong dest);
+
 /*
  * Translator Load Functions
  *
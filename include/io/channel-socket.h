@@ -261,5 +261,42 @@ QIOChannelSocket *
 qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Enable zero copy writes on a connected socket, so that
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY can be used. Sockets
+ * created by qio_channel_socket_connect_sync() try this
+ * on their own, accepted ones have to ask for it.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                     Error **errp);
+
+/**
+ * qio_channel_socket_zero_copy_poll:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Collect the completions of zero copy writes that are
+ * already available, without blocking, and update
+ * @ioc->zero_copy_sent accordingly. A zero copy write
+ * that brought @ioc->zero_copy_queued to N is done with
+ * its buffers once @ioc->zero_copy_sent reaches N.
+ *
+ * Completions are also collected whenever a read or
+ * write on the channel would block, so that they do not
+ * keep waking up coroutines waiting on the socket. Zero
+ * copy writes and reads must therefore not happen
+ * concurrently from different threads.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc,
+                                      Error **errp);
+
 
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -104,13 +104,37 @@ struct qemu_plugin_dyn_cb {
     enum qemu_plugin_mem_rw rw;
     /* fields specific to each dyn_cb type go here */
     union {
+        /* PLUGIN_CB_INLINE; @entry.score is NULL if @userp is the target */
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            qemu_plugin_u64 entry;
         } inline_insn;
+        /* PLUGIN_CB_REGULAR, except memory callbacks */
+        struct {
+            enum qemu_plugin_cond cond;
+            uint64_t imm;
+            qemu_plugin_u64 entry;
+        } cond;
     };
 };
 
+/* Per-vCPU storage behind a qemu_plugin_scoreboard */
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
+/* Address of the element of @vcpu_index for @entry */
+static inline uint64_t *qemu_plugin_u64_ptr(qemu_plugin_u64 entry,
+                                            unsigned int vcpu_index)
+{
+    GArray *data = entry.score->data;
+    size_t size = g_array_get_element_size(data);
+
+    return (uint64_t *)(data->data + vcpu_index * size + entry.offset);
+}
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
@@ -51,7 +51,16 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+/*
+ * Version history:
+ *
+ * version 2:
+ * - added scoreboards (qemu_plugin_scoreboard_*, qemu_plugin_u64_*)
+ * - added QEMU_PLUGIN_INLINE_STORE_U64
+ * - added qemu_plugin_register_vcpu_{tb,insn,mem}_*inline_per_vcpu
+ * - added qemu_plugin_register_vcpu_{tb,insn}_exec_cond_cb
+ */
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -270,18 +279,89 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
                                           enum qemu_plugin_cb_flags flags,
                                           void *userdata);
 
+/**
+ * struct qemu_plugin_scoreboard - opaque handle for a scoreboard
+ *
+ * A scoreboard is an array with one element per vCPU, allocated and
+ * grown by QEMU.  Inline operations can address the element of the vCPU
+ * that executes them, so that counters need neither atomics nor locks.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of an entry in a scoreboard
+ *
+ * @score: the scoreboard
+ * @offset: offset of the uint64_t within an element of @score
+ *
+ * This is the target of inline operations that act on the current vCPU's
+ * element of a scoreboard.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
 /**
  * enum qemu_plugin_op - describes an inline op
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
- *
- * Note: currently only a single inline op is supported.
+ * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
+};
+
+/**
+ * enum qemu_plugin_cond - condition of a conditional callback
+ *
+ * @QEMU_PLUGIN_COND_NEVER: never call the callback
+ * @QEMU_PLUGIN_COND_ALWAYS: always call the callback
+ * @QEMU_PLUGIN_COND_EQ: call if the value is equal to the immediate
+ * @QEMU_PLUGIN_COND_NE: call if the value is not equal to the immediate
+ * @QEMU_PLUGIN_COND_LT: call if the value is lower than the immediate
+ * @QEMU_PLUGIN_COND_LE: call if the value is lower or equal
+ * @QEMU_PLUGIN_COND_GT: call if the value is greater than the immediate
+ * @QEMU_PLUGIN_COND_GE: call if the value is greater or equal
+ *
+ * All comparisons are unsigned.
+ */
+enum qemu_plugin_cond {
+    QEMU_PLUGIN_COND_NEVER,
+    QEMU_PLUGIN_COND_ALWAYS,
+    QEMU_PLUGIN_COND_EQ,
+    QEMU_PLUGIN_COND_NE,
+    QEMU_PLUGIN_COND_LT,
+    QEMU_PLUGIN_COND_LE,
+    QEMU_PLUGIN_COND_GT,
+    QEMU_PLUGIN_COND_GE,
 };
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cond_cb() - conditional execution cb
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition on @entry and @imm
+ * @entry: the current vCPU's value is compared against @imm
+ * @imm: the value to compare with
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time a translated unit executes and
+ * @cond holds for the executing vCPU's @entry.  Combined with an inline
+ * op on the same @entry, this calls back only every N executions, for
+ * instance to flush per-vCPU counters.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *userdata);
+
 /**
  * qemu_plugin_register_vcpu_tb_exec_inline() - execution inline op
  * @tb: the opaque qemu_plugin_tb handle for the translation
@@ -294,12 +374,30 @@ enum qemu_plugin_op {
  * memory.
  *
  * Note: ops are not atomic so in multi-threaded/multi-smp situations
- * you will get inexact results.
+ * you will get inexact results.  Use
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() instead.
  */
 void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - execution inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry to update, in the element of the executing vCPU
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op to every time a translated unit executes.  Each
+ * vCPU only updates its own element of the scoreboard, so the result is
+ * exact even with multi-threaded TCG.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -328,6 +426,43 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - insn inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry to update, in the element of the executing vCPU
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op to every time an instruction executes.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cond_cb() - conditional insn cb
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @cb: callback function
+ * @flags: does the plugin read or write the CPU's registers?
+ * @cond: condition on @entry and @imm
+ * @entry: the current vCPU's value is compared against @imm
+ * @imm: the value to compare with
+ * @userdata: any plugin data to pass to the @cb?
+ *
+ * The @cb function is called every time an instruction executes and
+ * @cond holds for the executing vCPU's @entry.
+ */
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *userdata);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -497,6 +632,23 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - memory access inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @rw: monitor reads, writes or both
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: entry to update, in the element of the executing vCPU
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op to every memory access of an instruction.
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
 
 
 typedef void
@@ -572,6 +724,74 @@ int qemu_plugin_n_vcpus(void);
 /* returns -1 in user-mode */
 int qemu_plugin_n_max_vcpus(void);
 
+/**
+ * qemu_plugin_scoreboard_new() - allocate a new scoreboard
+ *
+ * @element_size: size (in bytes) of each element
+ *
+ * Returns a pointer to a new scoreboard.  It has one zeroed element for
+ * every vCPU, and grows as more vCPUs are created.  It must be freed
+ * with qemu_plugin_scoreboard_free().
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * No code referring to @score may execute anymore, e.g. call it from the
+ * atexit callback.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get pointer to an element of a scoreboard
+ * @score: scoreboard to query
+ * @vcpu_index: index of the vCPU
+ *
+ * Returns the address of the element of @vcpu_index.  The address may
+ * change when new vCPUs are created, so do not keep it around.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* Macros to define a qemu_plugin_u64 */
+#define qemu_plugin_scoreboard_u64(score) \
+    (qemu_plugin_u64) {score, 0}
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    (qemu_plugin_u64) {score, offsetof(type, member)}
+
+/**
+ * qemu_plugin_u64_add() - add a value to a qemu_plugin_u64 for a given vCPU
+ * @entry: entry to update
+ * @vcpu_index: index of the vCPU
+ * @added: value to add
+ */
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get the value of a qemu_plugin_u64 for a vCPU
+ * @entry: entry to query
+ * @vcpu_index: index of the vCPU
+ */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set the value of a qemu_plugin_u64 for a vCPU
+ * @entry: entry to update
+ * @vcpu_index: index of the vCPU
+ * @val: new value
+ */
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - return the sum of a qemu_plugin_u64 over all vCPUs
+ * @entry: entry to sum
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
 /**
  * qemu_plugin_outs() - output string via QEMU's logging system
  * @string: a string
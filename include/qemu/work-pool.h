@@ -0,0 +1,60 @@
+/*
+ * Pool of worker threads for data-parallel loops
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_WORK_POOL_H
+#define QEMU_WORK_POOL_H
+
+typedef struct WorkPool WorkPool;
+
+/*
+ * Called once for every index in [0, n) passed to work_pool_run().  It runs
+ * either in the calling thread or in one of the pool threads, which are
+ * registered with RCU but hold no locks.
+ */
+typedef void WorkPoolFunc(void *opaque, unsigned int index);
+
+/**
+ * work_pool_new: create a pool of worker threads
+ *
+ * @name: prefix for the thread names
+ * @threads: number of threads to spawn; with 0 work_pool_run() executes
+ *           everything in the calling thread
+ *
+ * The threads sleep until work_pool_run() is called.
+ */
+WorkPool *work_pool_new(const char *name, unsigned int threads);
+
+/**
+ * work_pool_free: stop the worker threads and free the pool
+ *
+ * @pool: the pool, may be NULL
+ */
+void work_pool_free(WorkPool *pool);
+
+/**
+ * work_pool_threads: number of worker threads in the pool
+ *
+ * @pool: the pool, may be NULL
+ */
+unsigned int work_pool_threads(WorkPool *pool);
+
+/**
+ * work_pool_run: call @func for every index in [0, @n)
+ *
+ * @pool: the pool, may be NULL to run everything in the calling thread
+ * @func: function to call
+ * @opaque: passed to @func
+ * @n: number of indexes
+ *
+ * The calling thread takes part in the work and returns once every call
+ * to @func has completed.  The order of the calls is unspecified.  Calls to
+ * work_pool_run() on the same pool must be serialized by the caller.
+ */
+void work_pool_run(WorkPool *pool, WorkPoolFunc *func, void *opaque,
+                   unsigned int n);
+
+#endif /* QEMU_WORK_POOL_H */
@@ -12,6 +12,7 @@
 #include "exec/memory.h"
 #include "qapi/qapi-types-common.h"
 #include "qemu/accel.h"
+#include "qemu/work-pool.h"
 #include "sysemu/kvm.h"
 
 typedef struct KVMSlot
@@ -107,6 +108,8 @@ struct KVMState
     } *as;
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
+    uint32_t kvm_dirty_ring_reap_threads; /* Helpers to reap vcpu rings */
+    WorkPool *kvm_dirty_ring_reap_pool;
     struct KVMDirtyRingReaper reaper;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
@@ -198,6 +198,10 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_v256             0
 #endif
 
+#ifndef TCG_TARGET_NB_CACHED_REGS
+#define TCG_TARGET_NB_CACHED_REGS       0
+#endif
+
 #ifndef TARGET_INSN_START_EXTRA_WORDS
 # define TARGET_INSN_START_WORDS 1
 #else
@@ -251,6 +255,9 @@ struct TCGLabel {
     unsigned has_value : 1;
     unsigned id : 14;
     unsigned refs : 16;
+    /* tcg_gen_code: branches allocated so far, and their valid cached regs */
+    unsigned seen_refs : 16;
+    TCGRegSet cached_valid;
     union {
         uintptr_t value;
         const tcg_insn_unit *value_ptr;
@@ -459,6 +466,9 @@ typedef struct TCGTemp {
     unsigned int mem_allocated:1;
     unsigned int temp_allocated:1;
     unsigned int temp_subindex:1;
+    /* Global kept in cached_reg across chained TBs, see tcg_global_cache. */
+    unsigned int cached:1;
+    TCGReg cached_reg:8;
 
     int64_t val;
     struct TCGTemp *mem_base;
@@ -550,6 +560,7 @@ struct TCGContext {
     int nb_globals;
     int nb_temps;
     int nb_indirects;
+    int nb_cached_globals;
     int nb_ops;
 
     /* goto_tb support */
@@ -559,6 +570,10 @@ struct TCGContext {
     uintptr_t *tb_jmp_target_addr; /* tb->jmp_target_arg if !direct_jump */
 
     TCGRegSet reserved_regs;
+    /* cached_reg of all cached globals, see tcg_global_cache */
+    TCGRegSet cached_regs;
+    /* cached_reg of the cached globals whose register holds their value */
+    TCGRegSet cached_valid_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
     intptr_t current_frame_offset;
     intptr_t frame_start;
@@ -614,6 +629,9 @@ struct TCGContext {
 
     /* descriptor of the instruction being translated */
     struct qemu_plugin_insn *plugin_insn;
+
+    /* if set, new ops are inserted before it rather than appended */
+    TCGOp *emit_before_op;
 #endif
 
     GHashTable *const_table[TCG_TYPE_COUNT];
@@ -643,6 +661,7 @@ extern __thread TCGContext *tcg_ctx;
 extern const void *tcg_code_gen_epilogue;
 extern uintptr_t tcg_splitwx_diff;
 extern TCGv_env cpu_env;
+extern unsigned int tcg_cached_regs_max;
 
 bool in_code_gen_buffer(const void *p);
 
@@ -802,9 +821,12 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
+size_t tcg_tb_index(const TranslationBlock *tb);
+size_t tcg_tb_index_max(void);
 
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
@@ -842,6 +864,7 @@ void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
 TCGTemp *tcg_global_mem_new_internal(TCGType, TCGv_ptr,
                                      intptr_t, const char *);
+bool tcg_global_cache(TCGTemp *);
 TCGTemp *tcg_temp_new_internal(TCGType, bool);
 void tcg_temp_free_internal(TCGTemp *);
 TCGv_vec tcg_temp_new_vec(TCGType type);
@@ -874,6 +897,11 @@ static inline TCGv_i32 tcg_global_mem_new_i32(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i32(t);
 }
 
+static inline bool tcg_global_cache_i32(TCGv_i32 v)
+{
+    return tcg_global_cache(tcgv_i32_temp(v));
+}
+
 static inline TCGv_i32 tcg_temp_new_i32(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I32, false);
@@ -893,6 +921,11 @@ static inline TCGv_i64 tcg_global_mem_new_i64(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i64(t);
 }
 
+static inline bool tcg_global_cache_i64(TCGv_i64 v)
+{
+    return tcg_global_cache(tcgv_i64_temp(v));
+}
+
 static inline TCGv_i64 tcg_temp_new_i64(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I64, false);
@@ -36,6 +36,25 @@
 
 #define SOCKET_MAX_FDS 16
 
+int qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                     Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to enable zero copy on socket");
+        return -1;
+    }
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    return 0;
+#else
+    error_setg(errp, "Zero copy is not supported on this host");
+    return -1;
+#endif
+}
+
 SocketAddress *
 qio_channel_socket_get_local_address(QIOChannelSocket *ioc,
                                      Error **errp)
@@ -163,15 +182,8 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    /* Zero copy is optional, the feature flag tells whether it worked */
+    qio_channel_socket_set_zero_copy(ioc, NULL);
 
     return 0;
 }
@@ -491,6 +503,100 @@ static void qio_channel_socket_copy_fds(struct msghdr *msg,
 }
 
 
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Collect the completion notifications of zero copy writes from the error
+ * queue, until every queued write is complete or, if @block is false, until
+ * the error queue is empty.  Returns -1 on error, 1 if every write seen
+ * fell back to copying and 0 otherwise.
+ */
+static int qio_channel_socket_zero_copy_complete(QIOChannelSocket *sioc,
+                                                 bool block,
+                                                 Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(sioc);
+    struct msghdr msg = {};
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    char control[CMSG_SPACE(sizeof(*serr))];
+    int received;
+    int ret;
+
+    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
+        return 0;
+    }
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    memset(control, 0, sizeof(control));
+
+    ret = 1;
+
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
+        if (received < 0) {
+            switch (errno) {
+            case EAGAIN:
+                if (!block) {
+                    return ret;
+                }
+                /* Nothing on errqueue, wait until something is available */
+                qio_channel_wait(ioc, G_IO_ERR);
+                continue;
+            case EINTR:
+                continue;
+            default:
+                error_setg_errno(errp, errno,
+                                 "Unable to read errqueue");
+                return -1;
+            }
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (cm->cmsg_level != SOL_IP   && cm->cmsg_type != IP_RECVERR &&
+            cm->cmsg_level != SOL_IPV6 && cm->cmsg_type != IPV6_RECVERR) {
+            error_setg_errno(errp, EPROTOTYPE,
+                             "Wrong cmsg in errqueue");
+            return -1;
+        }
+
+        serr = (void *) CMSG_DATA(cm);
+        if (serr->ee_errno != SO_EE_ORIGIN_NONE) {
+            error_setg_errno(errp, serr->ee_errno,
+                             "Error on socket");
+            return -1;
+        }
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, serr->ee_origin,
+                             "Error not from zero copy");
+            return -1;
+        }
+
+        /* No errors, count successfully finished sendmsg()*/
+        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+
+        /* If any sendmsg() succeeded using zero copy, return 0 at the end */
+        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Pending zero copy completions make the socket report G_IO_ERR, which wakes
+ * up whoever waits for G_IO_IN or G_IO_OUT.  Drain them before reporting
+ * QIO_CHANNEL_ERR_BLOCK, or the waiter would spin.
+ */
+static void qio_channel_socket_zero_copy_drain(QIOChannelSocket *sioc)
+{
+    if (sioc->zero_copy_sent != sioc->zero_copy_queued) {
+        qio_channel_socket_zero_copy_complete(sioc, false, NULL);
+    }
+}
+#endif /* QEMU_MSG_ZEROCOPY */
+
 static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
                                         const struct iovec *iov,
                                         size_t niov,
@@ -521,6 +627,9 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
         if (errno == EAGAIN) {
+#ifdef QEMU_MSG_ZEROCOPY
+            qio_channel_socket_zero_copy_drain(sioc);
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -595,6 +704,9 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     if (ret <= 0) {
         switch (errno) {
         case EAGAIN:
+#ifdef QEMU_MSG_ZEROCOPY
+            qio_channel_socket_zero_copy_drain(sioc);
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         case EINTR:
             goto retry;
@@ -710,75 +822,24 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 static int qio_channel_socket_flush(QIOChannel *ioc,
                                     Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
-    struct msghdr msg = {};
-    struct sock_extended_err *serr;
-    struct cmsghdr *cm;
-    char control[CMSG_SPACE(sizeof(*serr))];
-    int received;
-    int ret;
-
-    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
-        return 0;
-    }
-
-    msg.msg_control = control;
-    msg.msg_controllen = sizeof(control);
-    memset(control, 0, sizeof(control));
-
-    ret = 1;
-
-    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
-        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
-        if (received < 0) {
-            switch (errno) {
-            case EAGAIN:
-                /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
-                continue;
-            case EINTR:
-                continue;
-            default:
-                error_setg_errno(errp, errno,
-                                 "Unable to read errqueue");
-                return -1;
-            }
-        }
-
-        cm = CMSG_FIRSTHDR(&msg);
-        if (cm->cmsg_level != SOL_IP   && cm->cmsg_type != IP_RECVERR &&
-            cm->cmsg_level != SOL_IPV6 && cm->cmsg_type != IPV6_RECVERR) {
-            error_setg_errno(errp, EPROTOTYPE,
-                             "Wrong cmsg in errqueue");
-            return -1;
-        }
-
-        serr = (void *) CMSG_DATA(cm);
-        if (serr->ee_errno != SO_EE_ORIGIN_NONE) {
-            error_setg_errno(errp, serr->ee_errno,
-                             "Error on socket");
-            return -1;
-        }
-        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
-            error_setg_errno(errp, serr->ee_origin,
-                             "Error not from zero copy");
-            return -1;
-        }
+    return qio_channel_socket_zero_copy_complete(QIO_CHANNEL_SOCKET(ioc),
+                                                 true, errp);
+}
 
-        /* No errors, count successfully finished sendmsg()*/
-        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+#endif /* QEMU_MSG_ZEROCOPY */
 
-        /* If any sendmsg() succeeded using zero copy, return 0 at the end */
-        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
-            ret = 0;
-        }
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    if (ioc->zero_copy_sent != ioc->zero_copy_queued &&
+        qio_channel_socket_zero_copy_complete(ioc, false, errp) < 0) {
+        return -1;
     }
-
-    return ret;
+#endif
+    return 0;
 }
 
-#endif /* QEMU_MSG_ZEROCOPY */
-
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -173,6 +173,7 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
 
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch,
+                               iothread->parent_obj.aio_sqpoll_idle_ms,
                                errp);
 
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
@@ -20,6 +20,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
@@ -84,6 +85,7 @@
 #define DEFAULT_MIGRATE_DECOMPRESS_THREAD_COUNT 2
 /*0: means nocompress, 1: best speed, ... 9: best compress ratio */
 #define DEFAULT_MIGRATE_COMPRESS_LEVEL 1
+#define DEFAULT_MIGRATE_COMPRESS_METHOD COMPRESS_METHOD_ZLIB
 /* Define default autoconverge cpu throttle migration parameters */
 #define DEFAULT_MIGRATE_THROTTLE_TRIGGER_THRESHOLD 50
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INITIAL 20
@@ -101,6 +103,9 @@
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+/* 0: no dictionary training for multifd zstd */
+#define DEFAULT_MIGRATE_MULTIFD_ZSTD_DICT_SIZE 0
+#define DEFAULT_MIGRATE_ZERO_PAGE_DETECTION ZERO_PAGE_DETECTION_MULTIFD
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -505,6 +510,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -904,6 +911,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params = g_malloc0(sizeof(*params));
     params->has_compress_level = true;
     params->compress_level = s->parameters.compress_level;
+    params->has_compress_method = true;
+    params->compress_method = s->parameters.compress_method;
     params->has_compress_threads = true;
     params->compress_threads = s->parameters.compress_threads;
     params->has_compress_wait_thread = true;
@@ -938,6 +947,11 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->multifd_zlib_level = s->parameters.multifd_zlib_level;
     params->has_multifd_zstd_level = true;
     params->multifd_zstd_level = s->parameters.multifd_zstd_level;
+    params->has_multifd_zstd_dict_size = true;
+    params->multifd_zstd_dict_size = s->parameters.multifd_zstd_dict_size;
+    params->has_zero_page_detection = true;
+    params->zero_page_detection = s->parameters.zero_page_detection;
+    params->page_store = g_strdup(s->parameters.page_store);
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
     params->has_max_postcopy_bandwidth = true;
@@ -1056,6 +1070,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->dirty_sync_count = ram_counters.dirty_sync_count;
     info->ram->dirty_sync_missed_zero_copy =
             ram_counters.dirty_sync_missed_zero_copy;
+    info->ram->dirty_sync_duration = ram_counters.dirty_sync_duration;
+    info->ram->dedup_pages = ram_counters.dedup_pages;
     info->ram->postcopy_requests = ram_counters.postcopy_requests;
     info->ram->page_size = page_size;
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
@@ -1064,6 +1080,11 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->downtime_bytes = ram_counters.downtime_bytes;
     info->ram->postcopy_bytes = stat64_get(&ram_atomic_counters.postcopy_bytes);
 
+    if (migrate_use_multifd()) {
+        info->multifd_channels = multifd_query_channel_stats();
+        info->has_multifd_channels = info->multifd_channels != NULL;
+    }
+
     if (migrate_use_xbzrle()) {
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
         info->xbzrle_cache->cache_size = migrate_xbzrle_cache_size();
@@ -1510,6 +1531,14 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_zstd_dict_size &&
+        params->multifd_zstd_dict_size > MULTIFD_ZSTD_MAX_DICT_SIZE) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "multifd_zstd_dict_size",
+                   "a value between 0 and 1 MiB");
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -1588,6 +1617,10 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
         dest->compress_level = params->compress_level;
     }
 
+    if (params->has_compress_method) {
+        dest->compress_method = params->compress_method;
+    }
+
     if (params->has_compress_threads) {
         dest->compress_threads = params->compress_threads;
     }
@@ -1647,6 +1680,16 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_multifd_compression) {
         dest->multifd_compression = params->multifd_compression;
     }
+    if (params->has_multifd_zstd_dict_size) {
+        dest->multifd_zstd_dict_size = params->multifd_zstd_dict_size;
+    }
+    if (params->has_zero_page_detection) {
+        dest->zero_page_detection = params->zero_page_detection;
+    }
+    if (params->page_store) {
+        assert(params->page_store->type == QTYPE_QSTRING);
+        dest->page_store = params->page_store->u.s;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -1685,6 +1728,10 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
         s->parameters.compress_level = params->compress_level;
     }
 
+    if (params->has_compress_method) {
+        s->parameters.compress_method = params->compress_method;
+    }
+
     if (params->has_compress_threads) {
         s->parameters.compress_threads = params->compress_threads;
     }
@@ -1759,6 +1806,17 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_multifd_compression) {
         s->parameters.multifd_compression = params->multifd_compression;
     }
+    if (params->has_multifd_zstd_dict_size) {
+        s->parameters.multifd_zstd_dict_size = params->multifd_zstd_dict_size;
+    }
+    if (params->has_zero_page_detection) {
+        s->parameters.zero_page_detection = params->zero_page_detection;
+    }
+    if (params->page_store) {
+        g_free(s->parameters.page_store);
+        assert(params->page_store->type == QTYPE_QSTRING);
+        s->parameters.page_store = g_strdup(params->page_store->u.s);
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
@@ -1815,6 +1873,12 @@ void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
         params->tls_hostname->type = QTYPE_QSTRING;
         params->tls_hostname->u.s = strdup("");
     }
+    if (params->page_store
+        && params->page_store->type == QTYPE_QNULL) {
+        qobject_unref(params->page_store->u.n);
+        params->page_store->type = QTYPE_QSTRING;
+        params->page_store->u.s = strdup("");
+    }
 
     migrate_params_test_apply(params, &tmp);
 
@@ -2425,6 +2489,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2531,6 +2597,15 @@ int migrate_compress_level(void)
     return s->parameters.compress_level;
 }
 
+CompressMethod migrate_compress_method(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.compress_method;
+}
+
 int migrate_compress_threads(void)
 {
     MigrationState *s;
@@ -2650,6 +2725,36 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+uint64_t migrate_multifd_zstd_dict_size(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_zstd_dict_size;
+}
+
+ZeroPageDetection migrate_zero_page_detection(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.zero_page_detection;
+}
+
+const char *migrate_page_store(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    if (!s->parameters.page_store || !*s->parameters.page_store) {
+        return NULL;
+    }
+    return s->parameters.page_store;
+}
+
 #ifdef CONFIG_LINUX
 bool migrate_use_zero_copy_send(void)
 {
@@ -2742,6 +2847,15 @@ bool migrate_postcopy_preempt(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
 }
 
+bool migrate_dedup_pages(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DEDUP_PAGES];
+}
+
 /* migration thread support */
 /*
  * Something bad happened to the RP stream, mark an error
@@ -4313,6 +4427,8 @@ void migration_global_dump(Monitor *mon)
                    ms->decompress_error_check ? "on" : "off");
     monitor_printf(mon, "clear-bitmap-shift: %u\n",
                    ms->clear_bitmap_shift);
+    monitor_printf(mon, "dirty-sync-threads: %u\n",
+                   ms->dirty_sync_threads);
 }
 
 #define DEFINE_PROP_MIG_CAP(name, x)             \
@@ -4329,11 +4445,16 @@ static Property migration_properties[] = {
                       decompress_error_check, true),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_UINT8("x-dirty-sync-threads", MigrationState,
+                      dirty_sync_threads, 0),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
                       parameters.compress_level,
                       DEFAULT_MIGRATE_COMPRESS_LEVEL),
+    DEFINE_PROP_COMPRESS_METHOD("x-compress-method", MigrationState,
+                      parameters.compress_method,
+                      DEFAULT_MIGRATE_COMPRESS_METHOD),
     DEFINE_PROP_UINT8("x-compress-threads", MigrationState,
                       parameters.compress_threads,
                       DEFAULT_MIGRATE_COMPRESS_THREAD_COUNT),
@@ -4373,6 +4494,12 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
                       parameters.multifd_zstd_level,
                       DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_SIZE("multifd-zstd-dict-size", MigrationState,
+                      parameters.multifd_zstd_dict_size,
+                      DEFAULT_MIGRATE_MULTIFD_ZSTD_DICT_SIZE),
+    DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
+                      parameters.zero_page_detection,
+                      DEFAULT_MIGRATE_ZERO_PAGE_DETECTION),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -4397,6 +4524,7 @@ static Property migration_properties[] = {
     DEFINE_PROP_STRING("tls-creds", MigrationState, parameters.tls_creds),
     DEFINE_PROP_STRING("tls-hostname", MigrationState, parameters.tls_hostname),
     DEFINE_PROP_STRING("tls-authz", MigrationState, parameters.tls_authz),
+    DEFINE_PROP_STRING("page-store", MigrationState, parameters.page_store),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -4415,6 +4543,7 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-dedup-pages", MIGRATION_CAPABILITY_DEDUP_PAGES),
 #ifdef CONFIG_LINUX
     DEFINE_PROP_MIG_CAP("x-zero-copy-send",
             MIGRATION_CAPABILITY_ZERO_COPY_SEND),
@@ -4460,9 +4589,11 @@ static void migration_instance_init(Object *obj)
 
     params->tls_hostname = g_strdup("");
     params->tls_creds = g_strdup("");
+    params->page_store = g_strdup("");
 
     /* Set has_* up only for parameter checks */
     params->has_compress_level = true;
+    params->has_compress_method = true;
     params->has_compress_threads = true;
     params->has_compress_wait_thread = true;
     params->has_decompress_threads = true;
@@ -4478,6 +4609,8 @@ static void migration_instance_init(Object *obj)
     params->has_multifd_compression = true;
     params->has_multifd_zlib_level = true;
     params->has_multifd_zstd_level = true;
+    params->has_multifd_zstd_dict_size = true;
+    params->has_zero_page_detection = true;
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
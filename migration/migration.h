@@ -362,6 +362,12 @@ struct MigrationState {
      */
     uint8_t clear_bitmap_shift;
 
+    /*
+     * Number of threads that help the migration thread sync the dirty
+     * bitmaps of the RAMBlocks.  With 0 the migration thread does it alone.
+     */
+    uint8_t dirty_sync_threads;
+
     /*
      * This save hostname when out-going migration starts
      */
@@ -408,6 +414,9 @@ int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
 int migrate_multifd_zstd_level(void);
+uint64_t migrate_multifd_zstd_dict_size(void);
+ZeroPageDetection migrate_zero_page_detection(void);
+const char *migrate_page_store(void);
 
 #ifdef CONFIG_LINUX
 bool migrate_use_zero_copy_send(void);
@@ -428,6 +437,7 @@ uint64_t ram_get_total_transferred_pages(void);
 
 bool migrate_use_compression(void);
 int migrate_compress_level(void);
+CompressMethod migrate_compress_method(void);
 int migrate_compress_threads(void);
 int migrate_compress_wait_thread(void);
 int migrate_decompress_threads(void);
@@ -435,6 +445,7 @@ bool migrate_use_events(void);
 bool migrate_postcopy_blocktime(void);
 bool migrate_background_snapshot(void);
 bool migrate_postcopy_preempt(void);
+bool migrate_dedup_pages(void);
 
 /* Sending on the return path - generic and then for each message type */
 void migrate_send_rp_shut(MigrationIncomingState *mis,
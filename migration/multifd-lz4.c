@@ -0,0 +1,268 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * lz4 has no streaming API that fits the page-at-a-time way multifd hands
+ * out data, so every page is compressed as an independent block.  Each
+ * block in the packet is preceded by its big-endian 32-bit length; a length
+ * equal to the page size means the page did not compress and is sent raw.
+ */
+typedef uint32_t lz4_block_header;
+
+struct lz4_data {
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+    /* lz4 state for LZ4_compress_fast_extState() */
+    void *state;
+};
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    /* This is the maximum size of the compressed buffer */
+    z->zbuff_len = p->page_count *
+                   (sizeof(lz4_block_header) + LZ4_compressBound(p->page_size));
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    z->state = g_try_malloc(LZ4_sizeofState());
+    if (!z->zbuff || !z->state) {
+        g_free(z->zbuff);
+        g_free(z->state);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Close the channel and return memory.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(z->state);
+    z->state = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+    uint32_t out_pos = 0;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *page = p->pages->block->host + p->normal[i];
+        lz4_block_header *hdr = (lz4_block_header *)(z->zbuff + out_pos);
+        char *dst = (char *)(hdr + 1);
+        uint32_t avail = z->zbuff_len - out_pos - sizeof(*hdr);
+        int ret;
+
+        ret = LZ4_compress_fast_extState(z->state, (const char *)page, dst,
+                                         p->page_size,
+                                         MIN(avail, p->page_size - 1), 1);
+        if (ret <= 0) {
+            /* Incompressible page, send it as is */
+            if (avail < p->page_size) {
+                error_setg(errp, "multifd %u: compressed buffer too small",
+                           p->id);
+                return -1;
+            }
+            memcpy(dst, page, p->page_size);
+            ret = p->page_size;
+        }
+        stl_be_p(hdr, ret);
+        out_pos += sizeof(*hdr) + ret;
+    }
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = out_pos;
+    p->iovs_num++;
+    p->next_packet_size = out_pos;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = p->page_count *
+                   (sizeof(lz4_block_header) + LZ4_compressBound(p->page_size));
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * Return the memory allocated by lz4_recv_setup().
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint32_t in_pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u exceeds %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *page = p->host + p->normal[i];
+        uint32_t block_len;
+
+        if (in_size - in_pos < sizeof(lz4_block_header)) {
+            error_setg(errp, "multifd %u: truncated packet", p->id);
+            return -1;
+        }
+        block_len = ldl_be_p(z->zbuff + in_pos);
+        in_pos += sizeof(lz4_block_header);
+        if (block_len > in_size - in_pos || block_len > p->page_size) {
+            error_setg(errp, "multifd %u: invalid block size %u", p->id,
+                       block_len);
+            return -1;
+        }
+
+        if (block_len == p->page_size) {
+            memcpy(page, z->zbuff + in_pos, p->page_size);
+        } else {
+            ret = LZ4_decompress_safe((const char *)z->zbuff + in_pos,
+                                      (char *)page, block_len, p->page_size);
+            if (ret != p->page_size) {
+                error_setg(errp, "multifd %u: decompress returned %d "
+                           "expected %u", p->id, ret, p->page_size);
+                return -1;
+            }
+        }
+        in_pos += block_len;
+    }
+
+    if (in_pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, in_pos);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
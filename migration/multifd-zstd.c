@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include <zstd.h>
+#include <zdict.h>
 #include "qemu/rcu.h"
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
@@ -32,8 +33,28 @@ struct zstd_data {
     uint8_t *zbuff;
     /* size of compressed buffer */
     uint32_t zbuff_len;
+    /* pages sampled for dictionary training, NULL when not training */
+    uint8_t *samples;
+    /* size of each sample, all equal to the page size */
+    size_t *sample_sizes;
+    /* number of pages sampled so far */
+    unsigned nb_samples;
+    /* number of pages to sample before training */
+    unsigned max_samples;
+    /* trained dictionary, sent once with the next packet */
+    uint8_t *dict;
+    /* size of trained dictionary */
+    size_t dict_len;
 };
 
+/*
+ * zstd recommends training on roughly 100 times the dictionary size; cap
+ * the sample buffer so that large dictionaries do not cost too much memory
+ * per channel.
+ */
+#define ZSTD_DICT_SAMPLE_FACTOR 100
+#define ZSTD_DICT_MAX_SAMPLE_BYTES (16 * 1024 * 1024)
+
 /* Multifd zstd compression */
 
 /**
@@ -69,9 +90,34 @@ static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
     }
     /* This is the maxium size of the compressed buffer */
     z->zbuff_len = ZSTD_compressBound(MULTIFD_PACKET_SIZE);
+    if (migrate_multifd_zstd_dict_size()) {
+        size_t dict_size = migrate_multifd_zstd_dict_size();
+        size_t sample_bytes = MIN(dict_size * ZSTD_DICT_SAMPLE_FACTOR,
+                                  ZSTD_DICT_MAX_SAMPLE_BYTES);
+
+        /* Room for the dictionary and its length in the first packet */
+        z->zbuff_len += sizeof(uint32_t) + dict_size;
+        z->max_samples = MAX(sample_bytes / p->page_size, 1);
+        z->samples = g_try_malloc(z->max_samples * p->page_size);
+        z->sample_sizes = g_new(size_t, z->max_samples);
+        z->dict = g_try_malloc(dict_size);
+        if (!z->samples || !z->dict) {
+            ZSTD_freeCStream(z->zcs);
+            g_free(z->samples);
+            g_free(z->sample_sizes);
+            g_free(z->dict);
+            g_free(z);
+            error_setg(errp, "multifd %u: out of memory for zstd dictionary",
+                       p->id);
+            return -1;
+        }
+    }
     z->zbuff = g_try_malloc(z->zbuff_len);
     if (!z->zbuff) {
         ZSTD_freeCStream(z->zcs);
+        g_free(z->samples);
+        g_free(z->sample_sizes);
+        g_free(z->dict);
         g_free(z);
         error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
         return -1;
@@ -79,6 +125,68 @@ static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
     return 0;
 }
 
+/**
+ * zstd_free_samples: stop dictionary training
+ *
+ * @z: zstd state of the channel
+ */
+static void zstd_free_samples(struct zstd_data *z)
+{
+    g_free(z->samples);
+    z->samples = NULL;
+    g_free(z->sample_sizes);
+    z->sample_sizes = NULL;
+}
+
+/**
+ * zstd_sample_pages: collect pages for dictionary training
+ *
+ * Copy the pages of the packet into the sample buffer.  Once enough
+ * pages have been seen, train a dictionary and start a new zstd frame
+ * that uses it.
+ *
+ * Returns true if the current packet has to carry the dictionary.
+ *
+ * @p: Params for the channel that we are using
+ */
+static bool zstd_sample_pages(MultiFDSendParams *p)
+{
+    struct zstd_data *z = p->data;
+    size_t ret;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num && z->nb_samples < z->max_samples; i++) {
+        memcpy(z->samples + z->nb_samples * p->page_size,
+               p->pages->block->host + p->normal[i], p->page_size);
+        z->sample_sizes[z->nb_samples++] = p->page_size;
+    }
+    if (z->nb_samples < z->max_samples) {
+        return false;
+    }
+
+    ret = ZDICT_trainFromBuffer(z->dict, migrate_multifd_zstd_dict_size(),
+                                z->samples, z->sample_sizes, z->nb_samples);
+    zstd_free_samples(z);
+    if (ZDICT_isError(ret)) {
+        /* Not fatal, just carry on without a dictionary */
+        trace_multifd_zstd_dict_failed(p->id, ZDICT_getErrorName(ret));
+        return false;
+    }
+    z->dict_len = ret;
+
+    ret = ZSTD_CCtx_reset(z->zcs, ZSTD_reset_session_only);
+    if (!ZSTD_isError(ret)) {
+        ret = ZSTD_CCtx_loadDictionary(z->zcs, z->dict, z->dict_len);
+    }
+    if (ZSTD_isError(ret)) {
+        trace_multifd_zstd_dict_failed(p->id, ZSTD_getErrorName(ret));
+        z->dict_len = 0;
+        return false;
+    }
+    trace_multifd_zstd_dict_trained(p->id, z->nb_samples, z->dict_len);
+    return true;
+}
+
 /**
  * zstd_send_cleanup: cleanup send side
  *
@@ -95,6 +203,9 @@ static void zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
     z->zcs = NULL;
     g_free(z->zbuff);
     z->zbuff = NULL;
+    zstd_free_samples(z);
+    g_free(z->dict);
+    z->dict = NULL;
     g_free(p->data);
     p->data = NULL;
 }
@@ -113,13 +224,24 @@ static void zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
 static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
 {
     struct zstd_data *z = p->data;
+    bool send_dict = false;
     int ret;
     uint32_t i;
 
+    if (z->samples) {
+        send_dict = zstd_sample_pages(p);
+    }
+
     z->out.dst = z->zbuff;
     z->out.size = z->zbuff_len;
     z->out.pos = 0;
 
+    if (send_dict) {
+        stl_be_p(z->zbuff, z->dict_len);
+        memcpy(z->zbuff + sizeof(uint32_t), z->dict, z->dict_len);
+        z->out.pos = sizeof(uint32_t) + z->dict_len;
+    }
+
     for (i = 0; i < p->normal_num; i++) {
         ZSTD_EndDirective flush = ZSTD_e_continue;
 
@@ -158,6 +280,9 @@ static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
     p->iovs_num++;
     p->next_packet_size = z->out.pos;
     p->flags |= MULTIFD_FLAG_ZSTD;
+    if (send_dict) {
+        p->flags |= MULTIFD_FLAG_ZSTD_DICT;
+    }
 
     return 0;
 }
@@ -194,8 +319,12 @@ static int zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    /* To be safe, we reserve twice the size of the packet */
-    z->zbuff_len = MULTIFD_PACKET_SIZE * 2;
+    /*
+     * To be safe, we reserve twice the size of the packet, plus room for
+     * a dictionary sent by the source.
+     */
+    z->zbuff_len = MULTIFD_PACKET_SIZE * 2 + sizeof(uint32_t) +
+                   MULTIFD_ZSTD_MAX_DICT_SIZE;
     z->zbuff = g_try_malloc(z->zbuff_len);
     if (!z->zbuff) {
         ZSTD_freeDStream(z->zds);
@@ -251,6 +380,11 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
                    p->id, flags, MULTIFD_FLAG_ZSTD);
         return -1;
     }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u exceeds %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
     ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
 
     if (ret != 0) {
@@ -261,6 +395,36 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
     z->in.size = in_size;
     z->in.pos = 0;
 
+    if (p->flags & MULTIFD_FLAG_ZSTD_DICT) {
+        uint32_t dict_len;
+        size_t res;
+
+        if (in_size < sizeof(uint32_t)) {
+            error_setg(errp, "multifd %u: truncated zstd dictionary", p->id);
+            return -1;
+        }
+        dict_len = ldl_be_p(z->zbuff);
+        if (dict_len > in_size - sizeof(uint32_t)) {
+            error_setg(errp, "multifd %u: invalid zstd dictionary size %u",
+                       p->id, dict_len);
+            return -1;
+        }
+
+        /* The dictionary starts a new frame */
+        res = ZSTD_DCtx_reset(z->zds, ZSTD_reset_session_only);
+        if (!ZSTD_isError(res)) {
+            res = ZSTD_DCtx_loadDictionary(z->zds,
+                                           z->zbuff + sizeof(uint32_t),
+                                           dict_len);
+        }
+        if (ZSTD_isError(res)) {
+            error_setg(errp, "multifd %u: loading dictionary failed with %s",
+                       p->id, ZSTD_getErrorName(res));
+            return -1;
+        }
+        z->in.pos = sizeof(uint32_t) + dict_len;
+    }
+
     for (i = 0; i < p->normal_num; i++) {
         z->out.dst = p->host + p->normal[i];
         z->out.size = p->page_size;
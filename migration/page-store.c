@@ -0,0 +1,460 @@
+/*
+ * Content-addressed store for the RAM pages of snapshots
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "crypto/hash.h"
+#include "page-store.h"
+#include "trace.h"
+
+/*
+ * The store is a header followed by records, each holding one page:
+ *
+ *   header: magic, be32 version, be32 page size
+ *   record: SHA-256 of the page, be32 flags, be32 length, data
+ *
+ * Records are only ever appended, and a page is identified by the offset
+ * of its record, so any page can be read back without looking at the
+ * rest of the file.  The digest is what lets a new snapshot reuse the
+ * pages stored by earlier ones; it is read back when a writer opens the
+ * store.  A record cut short by a crash is dropped at that point.
+ */
+
+#define PAGE_STORE_MAGIC "QEMUPGST"
+#define PAGE_STORE_VERSION 1
+#define PAGE_STORE_DIGEST_LEN 32
+
+/* The data of the record is the page itself rather than a zstd frame */
+#define PAGE_STORE_RECORD_RAW 0x1
+
+typedef struct QEMU_PACKED PageStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+} PageStoreHeader;
+
+typedef struct QEMU_PACKED PageStoreRecord {
+    uint8_t digest[PAGE_STORE_DIGEST_LEN];
+    uint32_t flags;
+    uint32_t len;
+} PageStoreRecord;
+
+typedef struct PageStoreEntry {
+    uint8_t digest[PAGE_STORE_DIGEST_LEN];
+    uint64_t offset;
+} PageStoreEntry;
+
+struct PageStore {
+    char *path;
+    int fd;
+    bool writable;
+    /* A failed write left the end of the file in an unknown state */
+    bool failed;
+    size_t page_size;
+    /* Largest length of the data of a record */
+    size_t max_len;
+    /* End of the last record */
+    uint64_t size;
+    /* PageStoreEntry of every record, by digest; NULL if read-only */
+    GHashTable *entries;
+    /* Copy of the page being stored */
+    uint8_t *page;
+    /* Record being written or read */
+    uint8_t *buf;
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+#endif
+};
+
+static guint page_store_digest_hash(gconstpointer key)
+{
+    /* The digest is uniformly distributed already */
+    return ldl_he_p(key);
+}
+
+static gboolean page_store_digest_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, PAGE_STORE_DIGEST_LEN);
+}
+
+static void page_store_add_entry(PageStore *ps, const uint8_t *digest,
+                                 uint64_t offset)
+{
+    PageStoreEntry *entry;
+
+    if (g_hash_table_contains(ps->entries, digest)) {
+        return;
+    }
+    entry = g_new(PageStoreEntry, 1);
+    memcpy(entry->digest, digest, PAGE_STORE_DIGEST_LEN);
+    entry->offset = offset;
+    g_hash_table_insert(ps->entries, entry->digest, entry);
+}
+
+static int page_store_pread(PageStore *ps, void *buf, size_t len,
+                            uint64_t offset, Error **errp)
+{
+    uint8_t *p = buf;
+    ssize_t ret;
+
+    while (len) {
+        ret = pread(ps->fd, p, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            error_setg_errno(errp, errno, "Could not read page store %s",
+                             ps->path);
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of page store %s", ps->path);
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static int page_store_init_header(PageStore *ps, Error **errp)
+{
+    PageStoreHeader hdr;
+
+    memcpy(hdr.magic, PAGE_STORE_MAGIC, sizeof(hdr.magic));
+    hdr.version = cpu_to_be32(PAGE_STORE_VERSION);
+    hdr.page_size = cpu_to_be32(ps->page_size);
+    if (qemu_write_full(ps->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        error_setg_errno(errp, errno, "Could not write page store %s",
+                         ps->path);
+        return -1;
+    }
+    ps->size = sizeof(hdr);
+    return 0;
+}
+
+static int page_store_check_header(PageStore *ps, Error **errp)
+{
+    PageStoreHeader hdr;
+
+    if (page_store_pread(ps, &hdr, sizeof(hdr), 0, errp) < 0) {
+        return -1;
+    }
+    if (memcmp(hdr.magic, PAGE_STORE_MAGIC, sizeof(hdr.magic))) {
+        error_setg(errp, "%s is not a page store", ps->path);
+        return -1;
+    }
+    if (be32_to_cpu(hdr.version) != PAGE_STORE_VERSION) {
+        error_setg(errp, "Unsupported page store version %" PRIu32,
+                   be32_to_cpu(hdr.version));
+        return -1;
+    }
+    if (be32_to_cpu(hdr.page_size) != ps->page_size) {
+        error_setg(errp, "Page store %s holds pages of %" PRIu32
+                   " bytes, not %zu", ps->path, be32_to_cpu(hdr.page_size),
+                   ps->page_size);
+        return -1;
+    }
+    return 0;
+}
+
+/* Index the records of the store, and drop a record that was cut short */
+static int page_store_scan(PageStore *ps, uint64_t file_size, Error **errp)
+{
+    PageStoreRecord rec;
+    uint64_t offset = sizeof(PageStoreHeader);
+    uint32_t len;
+
+    while (offset + sizeof(rec) <= file_size) {
+        if (page_store_pread(ps, &rec, sizeof(rec), offset, errp) < 0) {
+            return -1;
+        }
+        len = be32_to_cpu(rec.len);
+        if (len > ps->max_len) {
+            error_setg(errp, "Corrupt record at offset %" PRIu64
+                       " of page store %s", offset, ps->path);
+            return -1;
+        }
+        if (offset + sizeof(rec) + len > file_size) {
+            break;
+        }
+        page_store_add_entry(ps, rec.digest, offset);
+        offset += sizeof(rec) + len;
+    }
+
+    if (offset != file_size) {
+        trace_page_store_truncate(ps->path, file_size, offset);
+        if (ftruncate(ps->fd, offset) < 0) {
+            error_setg_errno(errp, errno, "Could not truncate page store %s",
+                             ps->path);
+            return -1;
+        }
+    }
+    ps->size = offset;
+    return 0;
+}
+
+PageStore *page_store_open(const char *path, bool writable, size_t page_size,
+                           int level, Error **errp)
+{
+    PageStore *ps;
+    off_t file_size;
+    int ret;
+
+#ifndef CONFIG_ZSTD
+    error_setg(errp, "Page stores require zstd support");
+    return NULL;
+#endif
+
+    ps = g_new0(PageStore, 1);
+    ps->path = g_strdup(path);
+    ps->writable = writable;
+    ps->page_size = page_size;
+#ifdef CONFIG_ZSTD
+    ps->max_len = MAX(ZSTD_compressBound(page_size), page_size);
+#endif
+    if (writable) {
+        ps->fd = qemu_create(path, O_RDWR, 0600, errp);
+    } else {
+        ps->fd = qemu_open(path, O_RDONLY, errp);
+    }
+    if (ps->fd < 0) {
+        goto fail;
+    }
+
+    /*
+     * Records never change once they are written, so readers need no
+     * lock, but two writers would interleave their records.
+     */
+    if (writable) {
+        ret = qemu_lock_fd(ps->fd, 0, 0, true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not lock page store %s; "
+                             "is another process writing to it?", path);
+            goto fail;
+        }
+    }
+
+    file_size = lseek(ps->fd, 0, SEEK_END);
+    if (file_size < 0) {
+        error_setg_errno(errp, errno, "Could not get the size of %s", path);
+        goto fail;
+    }
+
+    if (file_size == 0 && writable) {
+        if (page_store_init_header(ps, errp) < 0) {
+            goto fail;
+        }
+        file_size = ps->size;
+    } else {
+        if (page_store_check_header(ps, errp) < 0) {
+            goto fail;
+        }
+        ps->size = file_size;
+    }
+
+    if (writable) {
+        ps->entries = g_hash_table_new_full(page_store_digest_hash,
+                                            page_store_digest_equal,
+                                            NULL, g_free);
+        if (page_store_scan(ps, file_size, errp) < 0) {
+            goto fail;
+        }
+        if (lseek(ps->fd, ps->size, SEEK_SET) < 0) {
+            error_setg_errno(errp, errno, "Could not seek in %s", path);
+            goto fail;
+        }
+    }
+
+    ps->page = qemu_memalign(qemu_real_host_page_size(), page_size);
+    ps->buf = g_malloc(sizeof(PageStoreRecord) + ps->max_len);
+#ifdef CONFIG_ZSTD
+    if (writable) {
+        ps->cctx = ZSTD_createCCtx();
+        if (!ps->cctx ||
+            ZSTD_isError(ZSTD_CCtx_setParameter(ps->cctx,
+                                                ZSTD_c_compressionLevel,
+                                                level))) {
+            error_setg(errp, "Could not set up zstd compression");
+            goto fail;
+        }
+    }
+    ps->dctx = ZSTD_createDCtx();
+    if (!ps->dctx) {
+        error_setg(errp, "Could not set up zstd decompression");
+        goto fail;
+    }
+#endif
+
+    trace_page_store_open(path, writable,
+                          ps->entries ? g_hash_table_size(ps->entries) : 0,
+                          ps->size);
+    return ps;
+
+fail:
+    page_store_close(ps);
+    return NULL;
+}
+
+void page_store_close(PageStore *ps)
+{
+    if (!ps) {
+        return;
+    }
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(ps->cctx);
+    ZSTD_freeDCtx(ps->dctx);
+#endif
+    if (ps->entries) {
+        g_hash_table_destroy(ps->entries);
+    }
+    if (ps->fd >= 0) {
+        qemu_close(ps->fd);
+    }
+    qemu_vfree(ps->page);
+    g_free(ps->buf);
+    g_free(ps->path);
+    g_free(ps);
+}
+
+uint64_t page_store_put(PageStore *ps, const void *page, size_t *written,
+                        Error **errp)
+{
+    PageStoreRecord *rec = (PageStoreRecord *)ps->buf;
+    uint8_t *data = ps->buf + sizeof(*rec);
+    uint8_t *digest = rec->digest;
+    size_t digest_len = PAGE_STORE_DIGEST_LEN;
+    PageStoreEntry *entry;
+    uint64_t offset;
+    size_t len = 0;
+    uint32_t flags = 0;
+
+    assert(ps->writable);
+    *written = 0;
+    if (ps->failed) {
+        error_setg(errp, "Page store %s could not be written", ps->path);
+        return PAGE_STORE_NONE;
+    }
+
+    /*
+     * The guest may be running: the digest and the data must come from
+     * the same copy of the page.
+     */
+    memcpy(ps->page, page, ps->page_size);
+    if (qcrypto_hash_bytes(QCRYPTO_HASH_ALG_SHA256, (const char *)ps->page,
+                           ps->page_size, &digest, &digest_len, errp) < 0) {
+        return PAGE_STORE_NONE;
+    }
+
+    entry = g_hash_table_lookup(ps->entries, digest);
+    if (entry) {
+        return entry->offset;
+    }
+
+#ifdef CONFIG_ZSTD
+    len = ZSTD_compress2(ps->cctx, data, ps->max_len, ps->page,
+                         ps->page_size);
+    if (ZSTD_isError(len)) {
+        len = ps->page_size;
+    }
+#endif
+    if (len >= ps->page_size) {
+        memcpy(data, ps->page, ps->page_size);
+        len = ps->page_size;
+        flags |= PAGE_STORE_RECORD_RAW;
+    }
+    rec->flags = cpu_to_be32(flags);
+    rec->len = cpu_to_be32(len);
+
+    len += sizeof(*rec);
+    if (qemu_write_full(ps->fd, ps->buf, len) != len) {
+        error_setg_errno(errp, errno, "Could not write page store %s",
+                         ps->path);
+        /* Do not leave a partial record before the next one */
+        if (ftruncate(ps->fd, ps->size) < 0 ||
+            lseek(ps->fd, ps->size, SEEK_SET) < 0) {
+            ps->failed = true;
+        }
+        return PAGE_STORE_NONE;
+    }
+
+    offset = ps->size;
+    page_store_add_entry(ps, digest, offset);
+    ps->size += len;
+    *written = len;
+    return offset;
+}
+
+int page_store_get(PageStore *ps, uint64_t loc, void *page, Error **errp)
+{
+    PageStoreRecord *rec = (PageStoreRecord *)ps->buf;
+    uint8_t *data = ps->buf + sizeof(*rec);
+    uint32_t len;
+
+    if (loc == PAGE_STORE_ZERO) {
+        memset(page, 0, ps->page_size);
+        return 0;
+    }
+
+    if (loc < sizeof(PageStoreHeader) || loc > ps->size ||
+        ps->size - loc < sizeof(*rec)) {
+        error_setg(errp, "Invalid location %" PRIu64 " in page store %s",
+                   loc, ps->path);
+        return -1;
+    }
+    if (page_store_pread(ps, rec, sizeof(*rec), loc, errp) < 0) {
+        return -1;
+    }
+
+    len = be32_to_cpu(rec->len);
+    if (len > ps->max_len || ps->size - loc - sizeof(*rec) < len) {
+        goto corrupt;
+    }
+
+    if (be32_to_cpu(rec->flags) & PAGE_STORE_RECORD_RAW) {
+        if (len != ps->page_size) {
+            goto corrupt;
+        }
+        return page_store_pread(ps, page, len, loc + sizeof(*rec), errp);
+    }
+
+    if (page_store_pread(ps, data, len, loc + sizeof(*rec), errp) < 0) {
+        return -1;
+    }
+#ifdef CONFIG_ZSTD
+    if (ZSTD_decompressDCtx(ps->dctx, page, ps->page_size, data, len) ==
+        ps->page_size) {
+        return 0;
+    }
+#endif
+
+corrupt:
+    error_setg(errp, "Corrupt record at offset %" PRIu64 " of page store %s",
+               loc, ps->path);
+    return -1;
+}
+
+int page_store_flush(PageStore *ps, Error **errp)
+{
+    if (ps->failed) {
+        error_setg(errp, "Page store %s could not be written", ps->path);
+        return -1;
+    }
+    if (qemu_fdatasync(ps->fd) < 0) {
+        error_setg_errno(errp, errno, "Could not flush page store %s",
+                         ps->path);
+        return -1;
+    }
+    return 0;
+}
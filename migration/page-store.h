@@ -0,0 +1,81 @@
+/*
+ * Content-addressed store for the RAM pages of snapshots
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_PAGE_STORE_H
+#define QEMU_MIGRATION_PAGE_STORE_H
+
+/*
+ * Location of a page in a page store.  Any other nonzero value is the
+ * offset of the record that holds the page.
+ */
+#define PAGE_STORE_NONE 0   /* page not stored */
+#define PAGE_STORE_ZERO 1   /* page is all zeroes, nothing stored */
+
+typedef struct PageStore PageStore;
+
+/**
+ * page_store_open: open a page store, creating it if it does not exist
+ *
+ * Returns the page store, or NULL on error
+ *
+ * A writable store is locked against other writers, and remembers the
+ * content of all pages it holds so that page_store_put() can reuse them.
+ * A read-only store only serves page_store_get(), and can be opened
+ * while another process adds pages to it.
+ *
+ * @path: path of the store file
+ * @writable: whether pages will be added to the store
+ * @page_size: size of the pages, which must match the store
+ * @level: zstd compression level for new pages
+ * @errp: pointer to a NULL-initialized error object
+ */
+PageStore *page_store_open(const char *path, bool writable, size_t page_size,
+                           int level, Error **errp);
+
+void page_store_close(PageStore *ps);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PageStore, page_store_close)
+
+/**
+ * page_store_put: add a page to the store
+ *
+ * Returns the location of the page, or PAGE_STORE_NONE on error
+ *
+ * If the store already holds a page with the same content, nothing is
+ * written and its location is returned.
+ *
+ * @ps: a writable page store
+ * @page: the page; it may change while it is being stored
+ * @written: set to the number of bytes added to the store
+ * @errp: pointer to a NULL-initialized error object
+ */
+uint64_t page_store_put(PageStore *ps, const void *page, size_t *written,
+                        Error **errp);
+
+/**
+ * page_store_get: read a page from the store
+ *
+ * Returns 0 on success, -1 on error
+ *
+ * @ps: the page store
+ * @loc: location of the page, as returned by page_store_put()
+ * @page: buffer for the page
+ * @errp: pointer to a NULL-initialized error object
+ */
+int page_store_get(PageStore *ps, uint64_t loc, void *page, Error **errp);
+
+/**
+ * page_store_flush: make the pages added so far persistent
+ *
+ * Returns 0 on success, -1 on error
+ *
+ * @ps: a writable page store
+ * @errp: pointer to a NULL-initialized error object
+ */
+int page_store_flush(PageStore *ps, Error **errp);
+
+#endif
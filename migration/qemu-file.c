@@ -821,9 +821,10 @@ uint64_t qemu_get_be64(QEMUFile *f)
 }
 
 /* return the size after compression, or negative value on error */
-static int qemu_compress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
+static int qemu_compress_data(void *opaque, uint8_t *dest, size_t dest_len,
                               const uint8_t *source, size_t source_len)
 {
+    z_stream *stream = opaque;
     int err;
 
     err = deflateReset(stream);
@@ -852,15 +853,27 @@ static int qemu_compress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
  */
 ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size)
+{
+    return qemu_put_compression_data_fn(f, compressBound(size),
+                                        qemu_compress_data, stream, p, size);
+}
+
+/* Like qemu_put_compression_data(), but compress with @compress.  @bound
+ * is the largest size @compress can produce for @size bytes of input.
+ */
+ssize_t qemu_put_compression_data_fn(QEMUFile *f, size_t bound,
+                                     QEMUFileCompressFunc *compress,
+                                     void *opaque, const uint8_t *p,
+                                     size_t size)
 {
     ssize_t blen = IO_BUF_SIZE - f->buf_index - sizeof(int32_t);
 
-    if (blen < compressBound(size)) {
+    if (blen < bound) {
         return -1;
     }
 
-    blen = qemu_compress_data(stream, f->buf + f->buf_index + sizeof(int32_t),
-                              blen, p, size);
+    blen = compress(opaque, f->buf + f->buf_index + sizeof(int32_t),
+                    blen, p, size);
     if (blen < 0) {
         return -1;
     }
@@ -110,8 +110,17 @@ bool qemu_file_is_writable(QEMUFile *f);
 
 size_t qemu_peek_buffer(QEMUFile *f, uint8_t **buf, size_t size, size_t offset);
 size_t qemu_get_buffer_in_place(QEMUFile *f, uint8_t **buf, size_t size);
+/* Returns the compressed size, or negative value on error */
+typedef int (QEMUFileCompressFunc)(void *opaque, uint8_t *dest,
+                                   size_t dest_len, const uint8_t *source,
+                                   size_t source_len);
+
 ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size);
+ssize_t qemu_put_compression_data_fn(QEMUFile *f, size_t bound,
+                                     QEMUFileCompressFunc *compress,
+                                     void *opaque, const uint8_t *p,
+                                     size_t size);
 int qemu_put_qemu_file(QEMUFile *f_des, QEMUFile *f_src);
 
 /*
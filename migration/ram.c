@@ -27,6 +27,9 @@
  */
 
 #include "qemu/osdep.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #include "qemu/cutils.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
@@ -50,12 +53,14 @@
 #include "exec/ram_addr.h"
 #include "exec/target_page.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/work-pool.h"
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "page-store.h"
 #include "sysemu/runstate.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
@@ -82,6 +87,7 @@
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+#define RAM_SAVE_FLAG_DEDUP            0x200
 
 XBZRLECacheStats xbzrle_counters;
 
@@ -381,6 +387,19 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Threads that help migration_bitmap_sync(), NULL if there are none */
+    WorkPool *dirty_sync_pool;
+    /*
+     * Pages already sent while the guest was stopped, indexed by a hash
+     * of their content.  NULL if the dedup-pages capability is off.
+     */
+    GHashTable *dedup_pages;
+    /* Value of ram_vm_run_gen when dedup_pages was last emptied */
+    uint64_t dedup_vm_run_gen;
+    /* Number of flush_compressed_data() calls so far */
+    uint64_t compress_flushes;
+    /* Where pages are saved instead of the stream, NULL if not in use */
+    PageStore *page_store;
 };
 typedef struct RAMState RAMState;
 
@@ -464,6 +483,9 @@ struct CompressParam {
 
     /* internally used fields */
     z_stream stream;
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zcctx;
+#endif
     uint8_t *originbuf;
 };
 typedef struct CompressParam CompressParam;
@@ -477,6 +499,9 @@ struct DecompressParam {
     uint8_t *compbuf;
     int len;
     z_stream stream;
+#ifdef CONFIG_ZSTD
+    ZSTD_DCtx *zdctx;
+#endif
 };
 typedef struct DecompressParam DecompressParam;
 
@@ -495,10 +520,28 @@ static QemuThread *decompress_threads;
 static QemuMutex decomp_done_lock;
 static QemuCond decomp_done_cond;
 
+/*
+ * The compress-method parameter can change while a migration is running,
+ * so the threads use the value it had when they were set up.
+ */
+static CompressMethod comp_method;
+static CompressMethod decomp_method;
+
 static int ram_save_host_page_urgent(PageSearchStatus *pss);
 
-static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
-                                 ram_addr_t offset, uint8_t *source_buf);
+static bool do_compress_ram_page(CompressParam *param, RAMBlock *block,
+                                 ram_addr_t offset);
+
+/* Largest compressed size of one target page with @method */
+static size_t compress_page_bound(CompressMethod method)
+{
+#ifdef CONFIG_ZSTD
+    if (method == COMPRESS_METHOD_ZSTD) {
+        return ZSTD_compressBound(TARGET_PAGE_SIZE);
+    }
+#endif
+    return compressBound(TARGET_PAGE_SIZE);
+}
 
 /* NOTE: page is the PFN not real ram_addr_t. */
 static void pss_init(PageSearchStatus *pss, RAMBlock *rb, ram_addr_t page)
@@ -533,8 +576,7 @@ static void *do_data_compress(void *opaque)
             param->block = NULL;
             qemu_mutex_unlock(&param->mutex);
 
-            zero_page = do_compress_ram_page(param->file, &param->stream,
-                                             block, offset, param->originbuf);
+            zero_page = do_compress_ram_page(param, block, offset);
 
             qemu_mutex_lock(&comp_done_lock);
             param->done = true;
@@ -579,6 +621,9 @@ static void compress_threads_save_cleanup(void)
         qemu_mutex_destroy(&comp_param[i].mutex);
         qemu_cond_destroy(&comp_param[i].cond);
         deflateEnd(&comp_param[i].stream);
+#ifdef CONFIG_ZSTD
+        ZSTD_freeCCtx(comp_param[i].zcctx);
+#endif
         g_free(comp_param[i].originbuf);
         qemu_fclose(comp_param[i].file);
         comp_param[i].file = NULL;
@@ -599,6 +644,7 @@ static int compress_threads_save_setup(void)
         return 0;
     }
     thread_count = migrate_compress_threads();
+    comp_method = migrate_compress_method();
     compress_threads = g_new0(QemuThread, thread_count);
     comp_param = g_new0(CompressParam, thread_count);
     qemu_cond_init(&comp_done_cond);
@@ -615,6 +661,23 @@ static int compress_threads_save_setup(void)
             goto exit;
         }
 
+#ifdef CONFIG_ZSTD
+        if (comp_method == COMPRESS_METHOD_ZSTD) {
+            ZSTD_CCtx *zcctx = ZSTD_createCCtx();
+
+            if (!zcctx ||
+                ZSTD_isError(ZSTD_CCtx_setParameter(
+                                 zcctx, ZSTD_c_compressionLevel,
+                                 migrate_compress_level()))) {
+                ZSTD_freeCCtx(zcctx);
+                deflateEnd(&comp_param[i].stream);
+                g_free(comp_param[i].originbuf);
+                goto exit;
+            }
+            comp_param[i].zcctx = zcctx;
+        }
+#endif
+
         /* comp_param[i].file is just used as a dummy buffer to save data,
          * set its ops to empty.
          */
@@ -1067,6 +1130,75 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Large RAMBlocks are synced in chunks of this size, so that the work can
+ * be spread across the dirty sync threads even for a single huge block.
+ * Chunks start on a dirty bitmap word boundary, so two chunks never touch
+ * the same word of rb->bmap.
+ */
+#define DIRTY_SYNC_CHUNK_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} DirtySyncChunk;
+
+typedef struct {
+    DirtySyncChunk *chunks;
+    Stat64 new_dirty_pages;
+} DirtySyncWork;
+
+static void ramblock_sync_dirty_chunk(void *opaque, unsigned int index)
+{
+    DirtySyncWork *work = opaque;
+    DirtySyncChunk *chunk = &work->chunks[index];
+    uint64_t new_dirty_pages;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        new_dirty_pages = cpu_physical_memory_sync_dirty_bitmap(chunk->block,
+                                                                chunk->start,
+                                                                chunk->length);
+    }
+    stat64_add(&work->new_dirty_pages, new_dirty_pages);
+}
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ram_sync_dirty_bitmaps(RAMState *rs)
+{
+    DirtySyncWork work = {};
+    unsigned int nr_chunks = 0;
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    ram_addr_t start;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        nr_chunks += DIV_ROUND_UP(block->used_length, DIRTY_SYNC_CHUNK_SIZE);
+    }
+
+    work.chunks = g_new(DirtySyncChunk, nr_chunks);
+    nr_chunks = 0;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        for (start = 0; start < block->used_length;
+             start += DIRTY_SYNC_CHUNK_SIZE) {
+            DirtySyncChunk *chunk = &work.chunks[nr_chunks++];
+
+            chunk->block = block;
+            chunk->start = start;
+            chunk->length = MIN(DIRTY_SYNC_CHUNK_SIZE,
+                                block->used_length - start);
+        }
+    }
+
+    work_pool_run(rs->dirty_sync_pool, ramblock_sync_dirty_chunk, &work,
+                  nr_chunks);
+    g_free(work.chunks);
+
+    new_dirty_pages = stat64_get(&work.new_dirty_pages);
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1178,7 +1310,7 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs)
 {
-    RAMBlock *block;
+    int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t end_time;
 
     ram_counters.dirty_sync_count++;
@@ -1192,15 +1324,16 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
-        }
+        ram_sync_dirty_bitmaps(rs);
         ram_counters.remaining = ram_bytes_remaining();
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
     memory_global_after_dirty_log_sync();
-    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    ram_counters.dirty_sync_duration =
+        qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period,
+                                    ram_counters.dirty_sync_duration);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -1289,8 +1422,13 @@ static int save_zero_page_to_file(PageSearchStatus *pss,
 static int save_zero_page(PageSearchStatus *pss, RAMBlock *block,
                           ram_addr_t offset)
 {
-    int len = save_zero_page_to_file(pss, block, offset);
+    int len;
+
+    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_NONE) {
+        return -1;
+    }
 
+    len = save_zero_page_to_file(pss, block, offset);
     if (len) {
         stat64_add(&ram_atomic_counters.duplicate, 1);
         ram_transferred_add(len);
@@ -1419,16 +1557,32 @@ static int ram_save_multifd_page(QEMUFile *file, RAMBlock *block,
     if (multifd_queue_page(file, block, offset) < 0) {
         return -1;
     }
-    stat64_add(&ram_atomic_counters.normal, 1);
+    /* The send threads account the page once they know if it is zero */
+    if (migrate_zero_page_detection() != ZERO_PAGE_DETECTION_MULTIFD) {
+        stat64_add(&ram_atomic_counters.normal, 1);
+    }
 
     return 1;
 }
 
-static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
-                                 ram_addr_t offset, uint8_t *source_buf)
+#ifdef CONFIG_ZSTD
+/* return the size after compression, or negative value on error */
+static int ram_zstd_compress(void *opaque, uint8_t *dest, size_t dest_len,
+                             const uint8_t *source, size_t source_len)
+{
+    size_t ret = ZSTD_compress2(opaque, dest, dest_len, source, source_len);
+
+    return ZSTD_isError(ret) ? -1 : ret;
+}
+#endif
+
+static bool do_compress_ram_page(CompressParam *param, RAMBlock *block,
+                                 ram_addr_t offset)
 {
     RAMState *rs = ram_state;
     PageSearchStatus *pss = &rs->pss[RAM_CHANNEL_PRECOPY];
+    QEMUFile *f = param->file;
+    uint8_t *source_buf = param->originbuf;
     uint8_t *p = block->host + offset;
     int ret;
 
@@ -1444,7 +1598,18 @@ static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
      * decompression
      */
     memcpy(source_buf, p, TARGET_PAGE_SIZE);
-    ret = qemu_put_compression_data(f, stream, source_buf, TARGET_PAGE_SIZE);
+#ifdef CONFIG_ZSTD
+    if (comp_method == COMPRESS_METHOD_ZSTD) {
+        ret = qemu_put_compression_data_fn(f,
+                                           compress_page_bound(comp_method),
+                                           ram_zstd_compress, param->zcctx,
+                                           source_buf, TARGET_PAGE_SIZE);
+    } else
+#endif
+    {
+        ret = qemu_put_compression_data(f, &param->stream, source_buf,
+                                        TARGET_PAGE_SIZE);
+    }
     if (ret < 0) {
         qemu_file_set_error(migrate_get_current()->to_dst_file, ret);
         error_report("compressed data failed!");
@@ -1478,6 +1643,7 @@ static void flush_compressed_data(RAMState *rs)
         return;
     }
     thread_count = migrate_compress_threads();
+    rs->compress_flushes++;
 
     qemu_mutex_lock(&comp_done_lock);
     for (idx = 0; idx < thread_count; idx++) {
@@ -2264,6 +2430,183 @@ static bool save_compress_page(RAMState *rs, PageSearchStatus *pss,
     return false;
 }
 
+/* Stop remembering pages once the dedup table holds this many */
+#define RAM_DEDUP_MAX_PAGES (1 << 20)
+
+/* Incremented every time the guest starts running */
+static uint64_t ram_vm_run_gen;
+
+typedef struct RAMDedupEntry {
+    uint64_t hash;
+    RAMBlock *block;
+    ram_addr_t offset;
+    /* Value of compress_flushes when the page was queued for compression */
+    uint64_t compress_flushes;
+    bool compressed;
+} RAMDedupEntry;
+
+static void ram_dedup_vm_state_change(void *opaque, bool running,
+                                      RunState state)
+{
+    if (running) {
+        qatomic_inc(&ram_vm_run_gen);
+    }
+}
+
+/*
+ * A page may only be sent as a reference to an earlier one if neither
+ * changed in between, so deduplication is limited to the time the guest
+ * is stopped.  Forget everything as soon as it has run.
+ */
+static bool ram_dedup_active(RAMState *rs)
+{
+    uint64_t gen;
+
+    if (!rs->dedup_pages || migration_in_postcopy() || rs->xbzrle_enabled ||
+        runstate_is_running()) {
+        return false;
+    }
+
+    gen = qatomic_read(&ram_vm_run_gen);
+    if (gen != rs->dedup_vm_run_gen) {
+        g_hash_table_remove_all(rs->dedup_pages);
+        rs->dedup_vm_run_gen = gen;
+    }
+    return true;
+}
+
+static uint64_t ram_dedup_hash(const uint8_t *p)
+{
+    const uint64_t *q = (const uint64_t *)p;
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    size_t i;
+
+    for (i = 0; i < TARGET_PAGE_SIZE / sizeof(uint64_t); i++) {
+        h = rol64((h ^ q[i]) * 0xff51afd7ed558ccdULL, 31);
+    }
+    return h;
+}
+
+/**
+ * save_dedup_page: send a page as a reference to an identical page
+ *
+ * Returns true if the page was sent; otherwise @hash is set to the hash
+ * of the page for ram_dedup_record().
+ *
+ * @rs: current RAM state
+ * @pss: current PSS channel
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ * @hash: hash of the page content
+ */
+static bool save_dedup_page(RAMState *rs, PageSearchStatus *pss,
+                            RAMBlock *block, ram_addr_t offset,
+                            uint64_t *hash)
+{
+    uint8_t *p = block->host + offset;
+    RAMDedupEntry *entry;
+    size_t len;
+
+    /* Zero pages are already cheaper to send as such */
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        *hash = 0;
+        return false;
+    }
+
+    *hash = ram_dedup_hash(p);
+    entry = g_hash_table_lookup(rs->dedup_pages, hash);
+    if (!entry || entry->block != block ||
+        memcmp(block->host + entry->offset, p, TARGET_PAGE_SIZE)) {
+        return false;
+    }
+
+    /*
+     * The compressed copy is only written to the stream when its thread
+     * is flushed; the reference must not overtake it.
+     */
+    if (entry->compressed && entry->compress_flushes == rs->compress_flushes) {
+        flush_compressed_data(rs);
+    }
+
+    len = save_page_header(pss, block, offset | RAM_SAVE_FLAG_DEDUP);
+    qemu_put_be64(pss->pss_channel, entry->offset);
+    ram_transferred_add(len + 8);
+    ram_counters.dedup_pages++;
+    trace_ram_save_dedup_page(block->idstr, offset, entry->offset);
+    return true;
+}
+
+/* Remember a page that was just sent, so that copies of it can be deduped */
+static void ram_dedup_record(RAMState *rs, RAMBlock *block, ram_addr_t offset,
+                             uint64_t hash, bool compressed)
+{
+    RAMDedupEntry *entry;
+
+    if (!hash || g_hash_table_size(rs->dedup_pages) >= RAM_DEDUP_MAX_PAGES ||
+        g_hash_table_contains(rs->dedup_pages, &hash)) {
+        return;
+    }
+
+    entry = g_new(RAMDedupEntry, 1);
+    entry->hash = hash;
+    entry->block = block;
+    entry->offset = offset;
+    entry->compress_flushes = rs->compress_flushes;
+    entry->compressed = compressed;
+    g_hash_table_insert(rs->dedup_pages, &entry->hash, entry);
+}
+
+/**
+ * ram_save_stored_page: save a page to the page store
+ *
+ * Returns the number of pages written, or a negative value on error
+ *
+ * Nothing goes to the stream: the location of the page is recorded in
+ * the store_map of the block, and sent by the "ram-store" section.
+ *
+ * @rs: current RAM state
+ * @pss: current PSS channel
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_stored_page(RAMState *rs, PageSearchStatus *pss,
+                                RAMBlock *block, ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    uint64_t *loc;
+    Error *local_err = NULL;
+    size_t written;
+
+    if (!block->store_map) {
+        error_report("RAM block %s was added during migration",
+                     block->idstr);
+        return -EINVAL;
+    }
+    loc = &block->store_map[offset >> TARGET_PAGE_BITS];
+
+    if (migrate_zero_page_detection() != ZERO_PAGE_DETECTION_NONE &&
+        buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        *loc = PAGE_STORE_ZERO;
+        stat64_add(&ram_atomic_counters.duplicate, 1);
+        return 1;
+    }
+
+    *loc = page_store_put(rs->page_store, p, &written, &local_err);
+    if (*loc == PAGE_STORE_NONE) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+
+    if (written) {
+        qemu_file_acct_rate_limit(pss->pss_channel, written);
+        ram_transferred_add(written);
+        stat64_add(&ram_atomic_counters.normal, 1);
+    } else {
+        ram_counters.dedup_pages++;
+    }
+    return 1;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -2276,16 +2619,41 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool dedup = false;
+    uint64_t hash = 0;
     int res;
 
     if (control_save_page(pss, block, offset, &res)) {
         return res;
     }
 
+    if (rs->page_store) {
+        return ram_save_stored_page(rs, pss, block, offset);
+    }
+
+    if (ram_dedup_active(rs)) {
+        if (save_dedup_page(rs, pss, block, offset, &hash)) {
+            return 1;
+        }
+        dedup = true;
+    }
+
     if (save_compress_page(rs, pss, block, offset)) {
+        if (dedup) {
+            ram_dedup_record(rs, block, offset, hash, true);
+        }
         return 1;
     }
 
+    /*
+     * With zero-page-detection=multifd the send threads check for zero
+     * pages, so hand the page to them directly.
+     */
+    if (migrate_use_multifd() && !migration_in_postcopy() &&
+        migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD) {
+        return ram_save_multifd_page(pss->pss_channel, block, offset);
+    }
+
     res = save_zero_page(pss, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2309,7 +2677,11 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
         return ram_save_multifd_page(pss->pss_channel, block, offset);
     }
 
-    return ram_save_page(rs, pss);
+    res = ram_save_page(rs, pss);
+    if (dedup && res > 0) {
+        ram_dedup_record(rs, block, offset, hash, false);
+    }
+    return res;
 }
 
 /* Should be called before sending a host page */
@@ -2591,6 +2963,11 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        work_pool_free((*rsp)->dirty_sync_pool);
+        if ((*rsp)->dedup_pages) {
+            g_hash_table_destroy((*rsp)->dedup_pages);
+        }
+        page_store_close((*rsp)->page_store);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2640,6 +3017,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->store_map);
+        block->store_map = NULL;
     }
 
     xbzrle_cleanup();
@@ -2960,6 +3339,20 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
 
+    if (migrate_get_current()->dirty_sync_threads) {
+        (*rsp)->dirty_sync_pool =
+            work_pool_new("mig/dirty-sync",
+                          migrate_get_current()->dirty_sync_threads);
+    }
+
+    if (migrate_dedup_pages() && !migrate_use_multifd() &&
+        !migrate_colo_enabled()) {
+        (*rsp)->dedup_pages = g_hash_table_new_full(g_int64_hash,
+                                                    g_int64_equal,
+                                                    NULL, g_free);
+        (*rsp)->dedup_vm_run_gen = qatomic_read(&ram_vm_run_gen);
+    }
+
     /*
      * Count the total number of pages used by ram blocks not including any
      * gaps due to alignment or unplugs.
@@ -3151,6 +3544,29 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/* Open the page store and set up where each page will be recorded */
+static int ram_page_store_setup(RAMState *rs)
+{
+    Error *local_err = NULL;
+    RAMBlock *block;
+
+    rs->page_store = page_store_open(migrate_page_store(), true,
+                                     TARGET_PAGE_SIZE,
+                                     migrate_compress_level(), &local_err);
+    if (!rs->page_store) {
+        error_report_err(local_err);
+        return -1;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            block->store_map =
+                g_new0(uint64_t, block->used_length >> TARGET_PAGE_BITS);
+        }
+    }
+    return 0;
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -3165,6 +3581,15 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     RAMBlock *block;
     int ret;
 
+    if (migrate_page_store() &&
+        (migrate_use_compression() || migrate_use_xbzrle() ||
+         migrate_use_multifd() || migrate_postcopy_ram() ||
+         migrate_dedup_pages() || migrate_colo_enabled())) {
+        error_report("page-store cannot be used with compress, xbzrle, "
+                     "multifd, postcopy-ram, dedup-pages or x-colo");
+        return -1;
+    }
+
     if (compress_threads_save_setup()) {
         return -1;
     }
@@ -3178,6 +3603,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->pss[RAM_CHANNEL_PRECOPY].pss_channel = f;
 
+    if (migrate_page_store() && ram_page_store_setup(*rsp)) {
+        return -1;
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
 
@@ -3570,11 +3999,21 @@ void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
 
 /* return the size after decompression, or negative value on error */
 static int
-qemu_uncompress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
+qemu_uncompress_data(DecompressParam *param, uint8_t *dest, size_t dest_len,
                      const uint8_t *source, size_t source_len)
 {
+    z_stream *stream = &param->stream;
     int err;
 
+#ifdef CONFIG_ZSTD
+    if (decomp_method == COMPRESS_METHOD_ZSTD) {
+        size_t ret = ZSTD_decompressDCtx(param->zdctx, dest, dest_len,
+                                         source, source_len);
+
+        return ZSTD_isError(ret) ? -1 : ret;
+    }
+#endif
+
     err = inflateReset(stream);
     if (err != Z_OK) {
         return -1;
@@ -3610,7 +4049,7 @@ static void *do_data_decompress(void *opaque)
 
             pagesize = TARGET_PAGE_SIZE;
 
-            ret = qemu_uncompress_data(&param->stream, des, pagesize,
+            ret = qemu_uncompress_data(param, des, pagesize,
                                        param->compbuf, len);
             if (ret < 0 && migrate_get_current()->decompress_error_check) {
                 error_report("decompress data failed");
@@ -3682,6 +4121,9 @@ static void compress_threads_load_cleanup(void)
         qemu_mutex_destroy(&decomp_param[i].mutex);
         qemu_cond_destroy(&decomp_param[i].cond);
         inflateEnd(&decomp_param[i].stream);
+#ifdef CONFIG_ZSTD
+        ZSTD_freeDCtx(decomp_param[i].zdctx);
+#endif
         g_free(decomp_param[i].compbuf);
         decomp_param[i].compbuf = NULL;
     }
@@ -3701,6 +4143,7 @@ static int compress_threads_load_setup(QEMUFile *f)
     }
 
     thread_count = migrate_decompress_threads();
+    decomp_method = migrate_compress_method();
     decompress_threads = g_new0(QemuThread, thread_count);
     decomp_param = g_new0(DecompressParam, thread_count);
     qemu_mutex_init(&decomp_done_lock);
@@ -3711,7 +4154,18 @@ static int compress_threads_load_setup(QEMUFile *f)
             goto exit;
         }
 
-        decomp_param[i].compbuf = g_malloc0(compressBound(TARGET_PAGE_SIZE));
+#ifdef CONFIG_ZSTD
+        if (decomp_method == COMPRESS_METHOD_ZSTD) {
+            decomp_param[i].zdctx = ZSTD_createDCtx();
+            if (!decomp_param[i].zdctx) {
+                inflateEnd(&decomp_param[i].stream);
+                goto exit;
+            }
+        }
+#endif
+
+        decomp_param[i].compbuf =
+            g_malloc0(compress_page_bound(decomp_method));
         qemu_mutex_init(&decomp_param[i].mutex);
         qemu_cond_init(&decomp_param[i].cond);
         decomp_param[i].done = true;
@@ -4047,7 +4501,7 @@ int ram_load_postcopy(QEMUFile *f, int channel)
         case RAM_SAVE_FLAG_COMPRESS_PAGE:
             tmp_page->all_zero = false;
             len = qemu_get_be32(f);
-            if (len < 0 || len > compressBound(TARGET_PAGE_SIZE)) {
+            if (len < 0 || len > compress_page_bound(decomp_method)) {
                 error_report("Invalid compressed data length: %d", len);
                 ret = -EINVAL;
                 break;
@@ -4152,6 +4606,41 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/**
+ * load_dedup_page: load a page sent as a reference to an earlier page
+ *
+ * Returns 0 for success or -EINVAL if the reference is invalid
+ *
+ * @f: QEMUFile where to read the data from
+ * @block: block that contains the page
+ * @host: host address of the page
+ */
+static int load_dedup_page(QEMUFile *f, RAMBlock *block, void *host)
+{
+    ram_addr_t src_offset = qemu_get_be64(f);
+    void *src;
+
+    if (migration_incoming_in_colo_state()) {
+        error_report("Received an unexpected deduplicated page");
+        return -EINVAL;
+    }
+
+    src = host_from_ram_block_offset(block, src_offset);
+    if (!src || (src_offset & ~TARGET_PAGE_MASK) ||
+        !ramblock_recv_bitmap_test_byte_offset(block, src_offset)) {
+        error_report("Invalid deduplicated page reference " RAM_ADDR_FMT
+                     " in %s", src_offset, block->idstr);
+        return -EINVAL;
+    }
+
+    /* The source page may still be in a decompression thread */
+    if (wait_for_decompress_done()) {
+        return -EINVAL;
+    }
+    memcpy(host, src, TARGET_PAGE_SIZE);
+    return 0;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -4175,6 +4664,7 @@ static int ram_load_precopy(QEMUFile *f)
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
         void *host = NULL, *host_bak = NULL;
+        RAMBlock *block = NULL;
         uint8_t ch;
 
         /*
@@ -4202,9 +4692,9 @@ static int ram_load_precopy(QEMUFile *f)
         }
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
-                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(mis, f, flags,
-                                                    RAM_CHANNEL_PRECOPY);
+                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE |
+                     RAM_SAVE_FLAG_DEDUP)) {
+            block = ram_block_from_stream(mis, f, flags, RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -4316,7 +4806,7 @@ static int ram_load_precopy(QEMUFile *f)
 
         case RAM_SAVE_FLAG_COMPRESS_PAGE:
             len = qemu_get_be32(f);
-            if (len < 0 || len > compressBound(TARGET_PAGE_SIZE)) {
+            if (len < 0 || len > compress_page_bound(decomp_method)) {
                 error_report("Invalid compressed data length: %d", len);
                 ret = -EINVAL;
                 break;
@@ -4332,6 +4822,11 @@ static int ram_load_precopy(QEMUFile *f)
                 break;
             }
             break;
+
+        case RAM_SAVE_FLAG_DEDUP:
+            ret = load_dedup_page(f, block, host);
+            break;
+
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
             multifd_recv_sync_main();
@@ -4568,6 +5063,161 @@ static SaveVMHandlers savevm_ram_handlers = {
     .resume_prepare = ram_resume_prepare,
 };
 
+/*
+ * With a page store, the "ram" section only moves pages into the store.
+ * The "ram-store" section comes after it, and carries the location of
+ * every page once the last one has been saved.
+ */
+#define RAM_STORE_SETUP 1
+#define RAM_STORE_INDEX 2
+
+static bool ram_store_is_active(void *opaque)
+{
+    RAMState **rsp = opaque;
+
+    return *rsp && (*rsp)->page_store;
+}
+
+static int ram_store_save_setup(QEMUFile *f, void *opaque)
+{
+    qemu_put_be32(f, RAM_STORE_SETUP);
+    return 0;
+}
+
+static int ram_store_save_complete(QEMUFile *f, void *opaque)
+{
+    RAMState **rsp = opaque;
+    Error *local_err = NULL;
+    RAMBlock *block;
+    unsigned long i;
+
+    /* The index must not refer to pages that could still be lost */
+    if (page_store_flush((*rsp)->page_store, &local_err) < 0) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+
+    qemu_put_be32(f, RAM_STORE_INDEX);
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            qemu_put_byte(f, strlen(block->idstr));
+            qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+            qemu_put_be64(f, block->used_length);
+            for (i = 0; i < block->used_length >> TARGET_PAGE_BITS; i++) {
+                qemu_put_be64(f, block->store_map[i]);
+            }
+        }
+    }
+    qemu_put_byte(f, 0);
+    qemu_fflush(f);
+
+    return qemu_file_get_error(f);
+}
+
+static int ram_store_check_incoming(void)
+{
+    if (!migrate_page_store()) {
+        error_report("The RAM of this migration stream is in a page store; "
+                     "set the page-store migration parameter");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Read the location of each page and load it from the store */
+static int ram_store_load_index(QEMUFile *f)
+{
+    g_autoptr(PageStore) ps = NULL;
+    Error *local_err = NULL;
+    char id[256];
+    RAMBlock *block;
+    ram_addr_t length, offset;
+    uint64_t loc;
+    void *host;
+    int len;
+
+    if (ram_store_check_incoming()) {
+        return -EINVAL;
+    }
+
+    /*
+     * Only open the store now: the source may have added pages to it
+     * until it sent the index.
+     */
+    ps = page_store_open(migrate_page_store(), false, TARGET_PAGE_SIZE, 0,
+                         &local_err);
+    if (!ps) {
+        error_report_err(local_err);
+        return -EINVAL;
+    }
+
+    while ((len = qemu_get_byte(f))) {
+        qemu_get_buffer(f, (uint8_t *)id, len);
+        id[len] = 0;
+        length = qemu_get_be64(f);
+
+        block = qemu_ram_block_by_name(id);
+        if (!block || ramblock_is_ignored(block)) {
+            error_report("Unknown RAM block %s in page store index", id);
+            return -EINVAL;
+        }
+        if (length != block->used_length) {
+            error_report("Length mismatch of RAM block %s in page store "
+                         "index: 0x" RAM_ADDR_FMT " in != 0x" RAM_ADDR_FMT,
+                         id, length, block->used_length);
+            return -EINVAL;
+        }
+
+        for (offset = 0; offset < length; offset += TARGET_PAGE_SIZE) {
+            loc = qemu_get_be64(f);
+            host = host_from_ram_block_offset(block, offset);
+            if (loc == PAGE_STORE_NONE) {
+                continue;
+            }
+            if (loc == PAGE_STORE_ZERO) {
+                ram_handle_compressed(host, 0, TARGET_PAGE_SIZE);
+                continue;
+            }
+            if (page_store_get(ps, loc, host, &local_err) < 0) {
+                error_report_err(local_err);
+                return -EIO;
+            }
+        }
+
+        if (qemu_file_get_error(f)) {
+            break;
+        }
+    }
+
+    return qemu_file_get_error(f);
+}
+
+static int ram_store_load(QEMUFile *f, void *opaque, int version_id)
+{
+    uint32_t cmd = qemu_get_be32(f);
+    int ret = 0;
+
+    switch (cmd) {
+    case RAM_STORE_SETUP:
+        return ram_store_check_incoming();
+    case RAM_STORE_INDEX:
+        WITH_RCU_READ_LOCK_GUARD() {
+            ret = ram_store_load_index(f);
+        }
+        return ret;
+    default:
+        error_report("Unknown page store command %" PRIu32, cmd);
+        return -EINVAL;
+    }
+}
+
+static SaveVMHandlers savevm_ram_store_handlers = {
+    .is_active = ram_store_is_active,
+    .save_setup = ram_store_save_setup,
+    .save_live_complete_precopy = ram_store_save_complete,
+    .load_state = ram_store_load,
+};
+
 static void ram_mig_ram_block_resized(RAMBlockNotifier *n, void *host,
                                       size_t old_size, size_t new_size)
 {
@@ -4631,5 +5281,9 @@ void ram_mig_init(void)
 {
     qemu_mutex_init(&XBZRLE.lock);
     register_savevm_live("ram", 0, 4, &savevm_ram_handlers, &ram_state);
+    /* Must come after "ram", whose pages it records */
+    register_savevm_live("ram-store", 0, 1, &savevm_ram_store_handlers,
+                         &ram_state);
     ram_block_notifier_add(&ram_mig_ram_notifier);
+    qemu_add_vm_change_state_handler(ram_dedup_vm_state_change, NULL);
 }
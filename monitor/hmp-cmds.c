@@ -259,6 +259,12 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        monitor_printf(mon, "dirty sync duration: %" PRIu64 " us\n",
+                       info->ram->dirty_sync_duration);
+        if (info->ram->dedup_pages) {
+            monitor_printf(mon, "dedup pages: %" PRIu64 " pages\n",
+                           info->ram->dedup_pages);
+        }
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
@@ -332,6 +338,25 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->compression->compression_rate);
     }
 
+    if (info->has_multifd_channels) {
+        MultiFDChannelStatsList *ch;
+
+        for (ch = info->multifd_channels; ch; ch = ch->next) {
+            MultiFDChannelStats *st = ch->value;
+
+            monitor_printf(mon, "multifd channel %u: packets %" PRIu64
+                           " pages %" PRIu64 " zero pages %" PRIu64
+                           " raw %" PRIu64
+                           " kbytes compressed %" PRIu64
+                           " kbytes rate %0.2f throughput %0.2f mbps\n",
+                           st->id, st->packets, st->normal_pages,
+                           st->zero_pages,
+                           st->raw_bytes >> 10, st->compressed_bytes >> 10,
+                           st->compression_rate,
+                           st->compression_throughput * 8 / 1e6);
+        }
+    }
+
     if (info->has_cpu_throttle_percentage) {
         monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
                        info->cpu_throttle_percentage);
@@ -414,6 +439,10 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_COMPRESS_LEVEL),
             params->compress_level);
+        assert(params->has_compress_method);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_COMPRESS_METHOD),
+            CompressMethod_str(params->compress_method));
         assert(params->has_compress_threads);
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_COMPRESS_THREADS),
@@ -476,6 +505,16 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
             MultiFDCompression_str(params->multifd_compression));
+        monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_ZSTD_DICT_SIZE),
+            params->multifd_zstd_dict_size);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_ZERO_PAGE_DETECTION),
+            ZeroPageDetection_str(params->zero_page_detection));
+        assert(params->page_store);
+        monitor_printf(mon, "%s: '%s'\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_PAGE_STORE),
+            params->page_store);
         monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -1093,6 +1132,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_compress_level = true;
         visit_type_uint8(v, param, &p->compress_level, &err);
         break;
+    case MIGRATION_PARAMETER_COMPRESS_METHOD:
+        p->has_compress_method = true;
+        visit_type_CompressMethod(v, param, &p->compress_method, &err);
+        break;
     case MIGRATION_PARAMETER_COMPRESS_THREADS:
         p->has_compress_threads = true;
         visit_type_uint8(v, param, &p->compress_threads, &err);
@@ -1183,6 +1226,20 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_multifd_zstd_level = true;
         visit_type_uint8(v, param, &p->multifd_zstd_level, &err);
         break;
+    case MIGRATION_PARAMETER_MULTIFD_ZSTD_DICT_SIZE:
+        p->has_multifd_zstd_dict_size = true;
+        visit_type_size(v, param, &p->multifd_zstd_dict_size, &err);
+        break;
+    case MIGRATION_PARAMETER_ZERO_PAGE_DETECTION:
+        p->has_zero_page_detection = true;
+        visit_type_ZeroPageDetection(v, param, &p->zero_page_detection,
+                                     &err);
+        break;
+    case MIGRATION_PARAMETER_PAGE_STORE:
+        p->page_store = g_new0(StrOrNull, 1);
+        p->page_store->type = QTYPE_QSTRING;
+        visit_type_str(v, param, &p->page_store->u.s, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         if (!visit_type_size(v, param, &cache_size, &err)) {
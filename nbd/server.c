@@ -26,6 +26,11 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "sysemu/iothread.h"
+
+#ifdef CONFIG_LINUX
+#include <sys/resource.h>
+#endif
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -40,6 +45,18 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads smaller than this are copied even with zero-copy enabled:
+ * pinning the pages and collecting the completion cost more than the copy.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (16 * KiB)
+
+/*
+ * Read payloads per connection that the kernel may still be sending from.
+ * The kernel charges them to RLIMIT_MEMLOCK, see nbd_zero_copy_max_pending().
+ */
+#define NBD_ZERO_COPY_MAX_PENDING (64 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -81,6 +98,15 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+
+    /*
+     * Set when @data was sent with zero-copy: the value of
+     * client->sioc->zero_copy_queued after the last such send, and the
+     * number of bytes sent.  See nbd_co_send_zero_copy().
+     */
+    ssize_t zero_copy_seq;
+    size_t zero_copy_bytes;
+    QTAILQ_ENTRY(NBDRequestData) zero_copy_next;
 };
 
 struct NBDExport {
@@ -99,6 +125,13 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* IOThreads for the connections' data transfers, see NBDClient.io_ctx */
+    IOThread **conn_iothreads;
+    size_t nr_conn_iothreads;
+    size_t next_conn_iothread;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -147,10 +180,116 @@ struct NBDClient {
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
+
+    /*
+     * If non-NULL, the AioContext of the IOThread that reads and writes
+     * @ioc after negotiation.  Request coroutines run in the export's
+     * AioContext and only switch to @io_ctx for the socket I/O, see
+     * nbd_client_io_begin().
+     */
+    IOThread *iothread;
+    AioContext *io_ctx;
+
+    /*
+     * Zero-copy sends of read payloads.  Requests whose data the kernel may
+     * still be sending from wait in @zero_copy_reqs until the sends are
+     * complete.  Requests are put in the export's AioContext while
+     * completions are collected where @ioc is attached, hence the lock.
+     */
+    bool zero_copy;
+    size_t zero_copy_max_pending;
+    QemuMutex zero_copy_lock;
+    QTAILQ_HEAD(, NBDRequestData) zero_copy_reqs; /* protected by lock */
+    size_t zero_copy_pending; /* bytes, protected by lock */
+
+    /* Statistics, accessed in the export's AioContext */
+    uint64_t stat_requests;
+    uint64_t stat_read_bytes;
+    uint64_t stat_written_bytes;
 };
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+/*
+ * Move the calling request coroutine to the connection's IOThread, if it
+ * has one, before doing I/O on client->ioc.  Must be paired with
+ * nbd_client_io_end() before touching any other client state.
+ */
+static void coroutine_fn nbd_client_io_begin(NBDClient *client)
+{
+    if (client->io_ctx) {
+        aio_co_reschedule_self(client->io_ctx);
+    }
+}
+
+static void coroutine_fn nbd_client_io_end(NBDClient *client)
+{
+    if (client->io_ctx) {
+        aio_co_reschedule_self(client->exp->common.ctx);
+    }
+}
+
+static void nbd_request_free(NBDRequestData *req)
+{
+    if (req->data) {
+        qemu_vfree(req->data);
+    }
+    g_free(req);
+}
+
+/*
+ * Free the requests whose zero-copy sends the kernel has completed.  Must
+ * run where client->ioc is attached.  Returns whether there is room for
+ * more zero-copy sends.
+ */
+static bool nbd_client_zero_copy_reap(NBDClient *client)
+{
+    NBDRequestData *req, *next;
+    Error *local_err = NULL;
+    bool ret;
+
+    if (qio_channel_socket_zero_copy_poll(client->sioc, &local_err) < 0) {
+        /* Pending requests are freed together with the client */
+        trace_nbd_zero_copy_fail(error_get_pretty(local_err));
+        error_free(local_err);
+        client->zero_copy = false;
+        return false;
+    }
+
+    qemu_mutex_lock(&client->zero_copy_lock);
+    QTAILQ_FOREACH_SAFE(req, &client->zero_copy_reqs, zero_copy_next, next) {
+        if (req->zero_copy_seq <= client->sioc->zero_copy_sent) {
+            QTAILQ_REMOVE(&client->zero_copy_reqs, req, zero_copy_next);
+            client->zero_copy_pending -= req->zero_copy_bytes;
+            nbd_request_free(req);
+        }
+    }
+    ret = client->zero_copy_pending < client->zero_copy_max_pending;
+    qemu_mutex_unlock(&client->zero_copy_lock);
+
+    return ret;
+}
+
+/*
+ * Pages being sent with MSG_ZEROCOPY are pinned and count against
+ * RLIMIT_MEMLOCK, which is only 8 MiB by default, so do not let a
+ * connection go beyond it.  Sends that still run into the limit, for
+ * example because of other connections, fall back to copying.
+ */
+static size_t nbd_zero_copy_max_pending(void)
+{
+    size_t max = NBD_ZERO_COPY_MAX_PENDING;
+#ifdef CONFIG_LINUX
+    struct rlimit rlim;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rlim) == 0 &&
+        rlim.rlim_cur != RLIM_INFINITY) {
+        max = MIN(max, rlim.rlim_cur);
+    }
+#endif
+    return max;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1350,11 +1489,41 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
-    if (client->exp && client->exp->common.ctx) {
+    /*
+     * Attach the channel to the connection's IOThread if the export has
+     * some, or else to the same AioContext as the export
+     */
+    if (client->exp && client->exp->nr_conn_iothreads) {
+        NBDExport *exp = client->exp;
+        size_t i = exp->next_conn_iothread++ % exp->nr_conn_iothreads;
+
+        client->iothread = exp->conn_iothreads[i];
+        client->io_ctx = iothread_get_aio_context(client->iothread);
+        qio_channel_attach_aio_context(client->ioc, client->io_ctx);
+        trace_nbd_negotiate_conn_iothread(exp->name, client->io_ctx);
+    } else if (client->exp && client->exp->common.ctx) {
         qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
     }
 
+    /* Zero-copy needs the plain socket, TLS encrypts into its own buffers */
+    if (client->exp && client->exp->zero_copy &&
+        client->ioc == QIO_CHANNEL(client->sioc)) {
+        Error *local_err = NULL;
+
+        client->zero_copy_max_pending = nbd_zero_copy_max_pending();
+        if (client->zero_copy_max_pending < NBD_ZERO_COPY_MIN_SIZE) {
+            trace_nbd_negotiate_zero_copy_fail(client->exp->name,
+                                               "RLIMIT_MEMLOCK too low");
+        } else if (qio_channel_socket_set_zero_copy(client->sioc,
+                                                    &local_err) < 0) {
+            trace_nbd_negotiate_zero_copy_fail(client->exp->name,
+                                               error_get_pretty(local_err));
+            error_free(local_err);
+        } else {
+            client->zero_copy = true;
+        }
+    }
+
     assert(!client->optlen);
     trace_nbd_negotiate_success();
 
@@ -1381,10 +1550,13 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
-            client->read_yielding = true;
+            if (client->zero_copy) {
+                nbd_client_zero_copy_reap(client);
+            }
+            qatomic_set(&client->read_yielding, true);
             qio_channel_yield(client->ioc, G_IO_IN);
-            client->read_yielding = false;
-            if (client->quiescing) {
+            qatomic_set(&client->read_yielding, false);
+            if (qatomic_read(&client->quiescing)) {
                 return -EAGAIN;
             }
             continue;
@@ -1458,6 +1630,8 @@ void nbd_client_get(NBDClient *client)
 void nbd_client_put(NBDClient *client)
 {
     if (--client->refcount == 0) {
+        NBDRequestData *req, *next_req;
+
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
@@ -1466,6 +1640,16 @@ void nbd_client_put(NBDClient *client)
         qio_channel_detach_aio_context(client->ioc);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
+
+        /*
+         * The socket is closed, so it does not matter anymore what the
+         * kernel sends from these buffers; it holds its own page references.
+         */
+        QTAILQ_FOREACH_SAFE(req, &client->zero_copy_reqs, zero_copy_next,
+                            next_req) {
+            nbd_request_free(req);
+        }
+        qemu_mutex_destroy(&client->zero_copy_lock);
         if (client->tlscreds) {
             object_unref(OBJECT(client->tlscreds));
         }
@@ -1516,10 +1700,14 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
-        qemu_vfree(req->data);
+    if (req->zero_copy_seq) {
+        /* The kernel may still be sending from req->data */
+        qemu_mutex_lock(&client->zero_copy_lock);
+        QTAILQ_INSERT_TAIL(&client->zero_copy_reqs, req, zero_copy_next);
+        qemu_mutex_unlock(&client->zero_copy_lock);
+    } else {
+        nbd_request_free(req);
     }
-    g_free(req);
 
     client->nb_requests--;
 
@@ -1542,6 +1730,8 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->common.ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        /* Exports with conn_iothreads never change their AioContext */
+        assert(!client->io_ctx);
         qio_channel_attach_aio_context(client->ioc, ctx);
 
         assert(client->nb_requests == 0);
@@ -1570,7 +1760,7 @@ static void nbd_drained_begin(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = true;
+        qatomic_set(&client->quiescing, true);
     }
 }
 
@@ -1580,11 +1770,41 @@ static void nbd_drained_end(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = false;
+        qatomic_set(&client->quiescing, false);
         nbd_client_receive_next_request(client);
     }
 }
 
+/* Drops the client reference taken by nbd_drained_poll() */
+static void nbd_client_put_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+    AioContext *ctx = client->exp->common.ctx;
+
+    aio_context_acquire(ctx);
+    nbd_client_put(client);
+    aio_context_release(ctx);
+}
+
+/*
+ * Runs in the connection's IOThread, where the receiving coroutine waits
+ * for data, so that it cannot race with the socket waking it up.
+ */
+static void nbd_client_wake_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    aio_context_acquire(client->io_ctx);
+    if (qatomic_read(&client->read_yielding)) {
+        qemu_aio_coroutine_enter(client->io_ctx, client->recv_coroutine);
+    }
+    aio_context_release(client->io_ctx);
+
+    /* The export's AioContext is fixed, see nbd_export_create() */
+    aio_bh_schedule_oneshot(client->exp->common.ctx, nbd_client_put_bh,
+                            client);
+}
+
 static bool nbd_drained_poll(void *opaque)
 {
     NBDExport *exp = opaque;
@@ -1596,9 +1816,16 @@ static bool nbd_drained_poll(void *opaque)
              * If there's a coroutine waiting for a request on nbd_read_eof()
              * enter it here so we don't depend on the client to wake it up.
              */
-            if (client->recv_coroutine != NULL && client->read_yielding) {
-                qemu_aio_coroutine_enter(exp->common.ctx,
-                                         client->recv_coroutine);
+            if (client->recv_coroutine != NULL &&
+                qatomic_read(&client->read_yielding)) {
+                if (client->io_ctx) {
+                    nbd_client_get(client);
+                    aio_bh_schedule_oneshot(client->io_ctx,
+                                            nbd_client_wake_bh, client);
+                } else {
+                    qemu_aio_coroutine_enter(exp->common.ctx,
+                                             client->recv_coroutine);
+                }
             }
 
             return true;
@@ -1769,6 +1996,33 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->has_zero_copy && arg->zero_copy;
+
+    if (arg->has_conn_iothreads) {
+        strList *iothreads;
+
+        for (iothreads = arg->conn_iothreads; iothreads;
+             iothreads = iothreads->next) {
+            IOThread *iothread = iothread_by_id(iothreads->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found",
+                           iothreads->value);
+                ret = -EINVAL;
+                goto fail_iothreads;
+            }
+            exp->conn_iothreads = g_renew(IOThread *, exp->conn_iothreads,
+                                          exp->nr_conn_iothreads + 1);
+            exp->conn_iothreads[exp->nr_conn_iothreads++] = iothread;
+            object_ref(OBJECT(iothread));
+        }
+
+        /*
+         * Coroutines move between the connection's IOThread and the
+         * export's AioContext, which must therefore stay the same.
+         */
+        blk_set_allow_aio_context_change(blk, false);
+    }
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1785,6 +2039,14 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     return 0;
 
+fail_iothreads:
+    for (i = 0; i < exp->nr_conn_iothreads; i++) {
+        object_unref(OBJECT(exp->conn_iothreads[i]));
+    }
+    g_free(exp->conn_iothreads);
+    for (i = 0; i < exp->nr_export_bitmaps; i++) {
+        bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
+    }
 fail:
     g_free(exp->export_bitmaps);
     g_free(exp->name);
@@ -1810,6 +2072,33 @@ nbd_export_aio_context(NBDExport *exp)
     return exp->common.ctx;
 }
 
+NbdServerClientInfoList *nbd_query_clients(void)
+{
+    NbdServerClientInfoList *head = NULL, **tail = &head;
+    NBDExport *exp;
+    NBDClient *client;
+
+    QTAILQ_FOREACH(exp, &exports, next) {
+        AioContext *ctx = exp->common.ctx;
+
+        aio_context_acquire(ctx);
+        QTAILQ_FOREACH(client, &exp->clients, next) {
+            NbdServerClientInfo *info = g_new0(NbdServerClientInfo, 1);
+
+            info->export = g_strdup(exp->common.id);
+            info->iothread = client->iothread ?
+                             iothread_get_id(client->iothread) : NULL;
+            info->requests = client->stat_requests;
+            info->read_bytes = client->stat_read_bytes;
+            info->written_bytes = client->stat_written_bytes;
+            QAPI_LIST_APPEND(tail, info);
+        }
+        aio_context_release(ctx);
+    }
+
+    return head;
+}
+
 static void nbd_export_request_shutdown(BlockExport *blk_exp)
 {
     NBDExport *exp = container_of(blk_exp, NBDExport, common);
@@ -1858,6 +2147,11 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    for (i = 0; i < exp->nr_conn_iothreads; i++) {
+        object_unref(OBJECT(exp->conn_iothreads[i]));
+    }
+    g_free(exp->conn_iothreads);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -1868,8 +2162,79 @@ const BlockExportDriver blk_exp_nbd = {
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
-static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
-                                        unsigned niov, Error **errp)
+/*
+ * Send the reply headers in all but the last element of @iov with a copy,
+ * since they live on the coroutine stack, and the payload in the last one
+ * with MSG_ZEROCOPY.  @req then must not be freed until the kernel is done.
+ * If the kernel cannot pin more memory for the process, send the rest of
+ * the payload with a copy and stop using zero-copy on this connection.
+ */
+static int coroutine_fn nbd_co_send_zero_copy(NBDClient *client,
+                                              struct iovec *iov,
+                                              unsigned niov,
+                                              NBDRequestData *req,
+                                              Error **errp)
+{
+    struct iovec payload = iov[niov - 1];
+    size_t sent = 0;
+    int ret;
+
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    while (ret == 0 && payload.iov_len) {
+        Error *local_err = NULL;
+        ssize_t len;
+
+        len = qio_channel_writev_full(client->ioc, &payload, 1, NULL, 0,
+                                      QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                      &local_err);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        if (len < 0) {
+            /* errno is preserved by error_setg_errno() */
+            if (errno == ENOBUFS) {
+                trace_nbd_zero_copy_fail(error_get_pretty(local_err));
+                error_free(local_err);
+                client->zero_copy = false;
+                ret = qio_channel_writev_all(client->ioc, &payload, 1, errp);
+            } else {
+                error_propagate(errp, local_err);
+                ret = -1;
+            }
+            break;
+        }
+        payload.iov_base += len;
+        payload.iov_len -= len;
+        sent += len;
+    }
+    qio_channel_set_cork(client->ioc, false);
+
+    if (sent) {
+        req->zero_copy_seq = client->sioc->zero_copy_queued;
+        req->zero_copy_bytes += sent;
+
+        qemu_mutex_lock(&client->zero_copy_lock);
+        client->zero_copy_pending += sent;
+        qemu_mutex_unlock(&client->zero_copy_lock);
+    }
+
+    trace_nbd_co_send_zero_copy(iov[niov - 1].iov_base, sent,
+                                req->zero_copy_seq);
+    return ret < 0 ? -EIO : 0;
+}
+
+/*
+ * If @req is non-NULL, the last element of @iov is read payload from
+ * @req->data, which may then be sent without copying it, see
+ * nbd_co_send_zero_copy().
+ */
+static int coroutine_fn nbd_co_send_iov_full(NBDClient *client,
+                                             struct iovec *iov,
+                                             unsigned niov,
+                                             NBDRequestData *req,
+                                             Error **errp)
 {
     int ret;
 
@@ -1877,7 +2242,16 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
-    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    nbd_client_io_begin(client);
+    if (req && client->zero_copy &&
+        iov[niov - 1].iov_len >= NBD_ZERO_COPY_MIN_SIZE &&
+        nbd_client_zero_copy_reap(client)) {
+        ret = nbd_co_send_zero_copy(client, iov, niov, req, errp);
+    } else {
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ?
+              -EIO : 0;
+    }
+    nbd_client_io_end(client);
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -1885,6 +2259,12 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
+                                        unsigned niov, Error **errp)
+{
+    return nbd_co_send_iov_full(client, iov, niov, NULL, errp);
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1893,10 +2273,11 @@ static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
     stq_be_p(&reply->handle, handle);
 }
 
+/* The reply carries @len bytes of @req->data if @req is non-NULL */
 static int nbd_co_send_simple_reply(NBDClient *client,
                                     uint64_t handle,
                                     uint32_t error,
-                                    void *data,
+                                    NBDRequestData *req,
                                     size_t len,
                                     Error **errp)
 {
@@ -1904,14 +2285,14 @@ static int nbd_co_send_simple_reply(NBDClient *client,
     int nbd_err = system_errno_to_nbd_errno(error);
     struct iovec iov[] = {
         {.iov_base = &reply, .iov_len = sizeof(reply)},
-        {.iov_base = data, .iov_len = len}
+        {.iov_base = req ? req->data : NULL, .iov_len = len}
     };
 
     trace_nbd_co_send_simple_reply(handle, nbd_err, nbd_err_lookup(nbd_err),
                                    len);
     set_be_simple_reply(&reply, nbd_err, handle);
 
-    return nbd_co_send_iov(client, iov, len ? 2 : 1, errp);
+    return nbd_co_send_iov_full(client, iov, len ? 2 : 1, req, errp);
 }
 
 static inline void set_be_chunk(NBDStructuredReplyChunk *chunk, uint16_t flags,
@@ -1939,7 +2320,9 @@ static int coroutine_fn nbd_co_send_structured_done(NBDClient *client,
     return nbd_co_send_iov(client, iov, 1, errp);
 }
 
+/* @data points into @req->data */
 static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
+                                                    NBDRequestData *req,
                                                     uint64_t handle,
                                                     uint64_t offset,
                                                     void *data,
@@ -1960,7 +2343,7 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_full(client, iov, 2, req, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
@@ -1992,14 +2375,15 @@ static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
  * reported to the client, at which point this function succeeds.
  */
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
+                                                NBDRequestData *req,
                                                 uint64_t handle,
                                                 uint64_t offset,
-                                                uint8_t *data,
                                                 size_t size,
                                                 Error **errp)
 {
     int ret = 0;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
     size_t progress = 0;
 
     while (progress < size) {
@@ -2042,7 +2426,8 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                 error_setg_errno(errp, -ret, "reading from file failed");
                 break;
             }
-            ret = nbd_co_send_structured_read(client, handle, offset + progress,
+            ret = nbd_co_send_structured_read(client, req, handle,
+                                              offset + progress,
                                               data + progress, pnum, final,
                                               errp);
         }
@@ -2421,10 +2806,11 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
-                                        uint8_t *data, Error **errp)
+                                        NBDRequestData *req, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
 
     assert(request->type == NBD_CMD_READ);
 
@@ -2440,8 +2826,8 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
     if (client->structured_reply && !(request->flags & NBD_CMD_FLAG_DF) &&
         request->len)
     {
-        return nbd_co_send_sparse_read(client, request->handle, request->from,
-                                       data, request->len, errp);
+        return nbd_co_send_sparse_read(client, req, request->handle,
+                                       request->from, request->len, errp);
     }
 
     ret = blk_pread(exp->common.blk, request->from, request->len, data, 0);
@@ -2452,7 +2838,7 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
 
     if (client->structured_reply) {
         if (request->len) {
-            return nbd_co_send_structured_read(client, request->handle,
+            return nbd_co_send_structured_read(client, req, request->handle,
                                                request->from, data,
                                                request->len, true, errp);
         } else {
@@ -2460,7 +2846,7 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
         }
     } else {
         return nbd_co_send_simple_reply(client, request->handle, 0,
-                                        data, request->len, errp);
+                                        req, request->len, errp);
     }
 }
 
@@ -2491,7 +2877,7 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
  * client as an error reply. */
 static coroutine_fn int nbd_handle_request(NBDClient *client,
                                            NBDRequest *request,
-                                           uint8_t *data, Error **errp)
+                                           NBDRequestData *req, Error **errp)
 {
     int ret;
     int flags;
@@ -2504,15 +2890,15 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_do_cmd_cache(client, request, errp);
 
     case NBD_CMD_READ:
-        return nbd_do_cmd_read(client, request, data, errp);
+        return nbd_do_cmd_read(client, request, req, errp);
 
     case NBD_CMD_WRITE:
         flags = 0;
         if (request->flags & NBD_CMD_FLAG_FUA) {
             flags |= BDRV_REQ_FUA;
         }
-        ret = blk_pwrite(exp->common.blk, request->from, request->len, data,
-                         flags);
+        ret = blk_pwrite(exp->common.blk, request->from, request->len,
+                         req->data, flags);
         return nbd_send_generic_reply(client, request->handle, ret,
                                       "writing to file failed", errp);
 
@@ -2644,7 +3030,9 @@ static coroutine_fn void nbd_trip(void *opaque)
     }
 
     req = nbd_request_get(client);
+    nbd_client_io_begin(client);
     ret = nbd_co_receive_request(req, &request, &local_err);
+    nbd_client_io_end(client);
     client->recv_coroutine = NULL;
 
     if (client->closing) {
@@ -2675,13 +3063,20 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, &request, req, &local_err);
     }
     if (ret < 0) {
         error_prepend(&local_err, "Failed to send reply: ");
         goto disconnect;
     }
 
+    client->stat_requests++;
+    if (request.type == NBD_CMD_READ) {
+        client->stat_read_bytes += request.len;
+    } else if (request.type == NBD_CMD_WRITE) {
+        client->stat_written_bytes += request.len;
+    }
+
     /* We must disconnect after NBD_CMD_WRITE if we did not
      * read the payload.
      */
@@ -2757,6 +3152,8 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
+    qemu_mutex_init(&client->zero_copy_lock);
+    QTAILQ_INIT(&client->zero_copy_reqs);
 
     co = qemu_coroutine_create(nbd_co_client_start, client);
     qemu_coroutine_enter(co);
@@ -19,6 +19,7 @@
 #include "qemu/option.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/xxhash.h"
+#include "qemu/host-utils.h"
 #include "qemu/rcu.h"
 #include "hw/core/cpu.h"
 #include "exec/cpu-common.h"
@@ -210,9 +211,51 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Generated code embeds the address of scoreboards, so resizing them
+ * requires all vCPUs to be stopped and the code cache to be flushed.
+ * When no vCPU has been created yet, nothing can refer to them.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    bool exclusive = current_cpu != NULL;
+    struct qemu_plugin_scoreboard *score;
+
+    if (exclusive) {
+        start_exclusive();
+    }
+    qemu_rec_mutex_lock(&plugin.lock);
+
+    if (cpu->cpu_index >= plugin.scoreboard_alloc_size) {
+        plugin.scoreboard_alloc_size = pow2ceil(cpu->cpu_index + 1);
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+        }
+        if (exclusive && !QLIST_EMPTY(&plugin.scoreboards)) {
+            tb_flush(current_cpu);
+        }
+    }
+
+    qemu_rec_mutex_unlock(&plugin.lock);
+    if (exclusive) {
+        end_exclusive();
+    }
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
+    bool grow;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    plugin.num_vcpus = MAX(plugin.num_vcpus, cpu->cpu_index + 1);
+    grow = !QLIST_EMPTY(&plugin.scoreboards) &&
+           cpu->cpu_index >= plugin.scoreboard_alloc_size;
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    if (grow) {
+        plugin_grow_scoreboards(cpu);
+    }
 
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
@@ -292,6 +335,24 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry.score = NULL;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry = entry;
 }
 
 void plugin_register_dyn_cb__udata(GArray **arr,
@@ -305,6 +366,37 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     /* Note flags are discarded as unused. */
     dyn_cb->f.vcpu_udata = cb;
     dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->cond.cond = QEMU_PLUGIN_COND_ALWAYS;
+}
+
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    switch (cond) {
+    case QEMU_PLUGIN_COND_NEVER:
+        return;
+    case QEMU_PLUGIN_COND_ALWAYS:
+        plugin_register_dyn_cb__udata(arr, cb, flags, udata);
+        return;
+    default:
+        break;
+    }
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = udata;
+    /* Note flags are discarded as unused. */
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.imm = imm;
+    dyn_cb->cond.entry = entry;
 }
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
@@ -432,14 +524,21 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
     uint64_t *val = cb->userp;
 
+    if (cb->inline_insn.entry.score) {
+        val = qemu_plugin_u64_ptr(cb->inline_insn.entry, cpu_index);
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -467,7 +566,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -475,6 +574,40 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
     }
 }
 
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score =
+        g_new0(struct qemu_plugin_scoreboard, 1);
+
+    score->data = g_array_new(false, true, element_size);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        /*
+         * In system mode, size scoreboards for all the vCPUs that can ever
+         * be created.  In user mode threads may create more, see
+         * plugin_grow_scoreboards().
+         */
+        int n = MAX(qemu_plugin_n_max_vcpus(), plugin.num_vcpus);
+
+        plugin.scoreboard_alloc_size = pow2ceil(MAX(n, 16));
+    }
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
 void qemu_plugin_atexit_cb(void)
 {
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
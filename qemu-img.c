@@ -44,6 +44,7 @@
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
 #include "block/block_int.h"
@@ -85,6 +86,8 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_WORKER_THREADS = 278,
+    OPTION_STATS = 279,
 };
 
 typedef enum OutputFormat {
@@ -204,8 +207,11 @@ void help(void)
            "Parameters to convert subcommand:\n"
            "  '--bitmaps' copies all top-level persistent bitmaps to destination\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
-           "       process (defaults to 8)\n"
+           "       process (defaults to 8, at most 256)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--worker-threads' sets how many threads qcow2 images use for\n"
+           "       compression and decompression (encryption uses at most 4)\n"
+           "  '--stats' prints the time and throughput of each phase at the end\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1644,9 +1650,15 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 256
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+typedef struct ImgConvertOpStats {
+    int64_t requests;
+    int64_t bytes;
+    int64_t busy_ns;
+} ImgConvertOpStats;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1674,13 +1686,30 @@ typedef struct ImgConvertState {
     size_t cluster_sectors;
     size_t buf_sectors;
     long num_coroutines;
+    int64_t compress_clusters;
     int running_coroutines;
-    Coroutine *co[MAX_COROUTINES];
-    int64_t wait_sector_num[MAX_COROUTINES];
+    Coroutine **co;
+    int64_t *wait_sector_num;
     CoMutex lock;
     int ret;
+
+    /* Statistics for --stats */
+    int64_t status_ns;
+    int64_t copy_ns;
+    int64_t bitmaps_ns;
+    ImgConvertOpStats read_stats;
+    ImgConvertOpStats write_stats;
+    ImgConvertOpStats zero_stats;
 } ImgConvertState;
 
+static void convert_account(ImgConvertOpStats *stats, int64_t bytes,
+                            int64_t start_ns)
+{
+    stats->requests++;
+    stats->bytes += bytes;
+    stats->busy_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1853,6 +1882,29 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+/*
+ * Return how many of the @n sectors in @buf, starting at a cluster boundary,
+ * are in clusters that are all zero or all not zero like the first one, and
+ * store in @zero which of the two it is.
+ */
+static int convert_compressed_run(ImgConvertState *s, const uint8_t *buf,
+                                  int n, bool *zero)
+{
+    int run = MIN(n, s->cluster_sectors);
+
+    *zero = buffer_is_zero(buf, run * BDRV_SECTOR_SIZE);
+    while (run < n) {
+        int len = MIN(n - run, s->cluster_sectors);
+
+        if (buffer_is_zero(buf + run * BDRV_SECTOR_SIZE,
+                           len * BDRV_SECTOR_SIZE) != *zero) {
+            break;
+        }
+        run += len;
+    }
+    return run;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1862,6 +1914,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     while (nb_sectors > 0) {
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
+        bool zero = false;
 
         switch (status) {
         case BLK_BACKING_FILE:
@@ -1876,14 +1929,17 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write of completely zeroed clusters.
+             * The buffer may hold several clusters, which the format driver
+             * compresses in parallel, so write the non-zero ones together. */
+            if (s->compressed && s->min_sparse) {
+                n = convert_compressed_run(s, buf, n, &zero);
+            }
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                (s->compressed && !zero))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1952,6 +2008,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
     uint8_t *buf = NULL;
+    int64_t start_ns;
     int ret, i;
     int index = -1;
 
@@ -2003,7 +2060,9 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             ret = convert_co_read(s, sector_num, n, buf);
+            convert_account(&s->read_stats, n * BDRV_SECTOR_SIZE, start_ns);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2024,6 +2083,7 @@ retry:
         }
 
         if (s->ret == -EINPROGRESS) {
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             if (copy_range) {
                 ret = convert_co_copy_range(s, sector_num, n);
                 if (ret) {
@@ -2033,6 +2093,11 @@ retry:
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
             }
+            if (status != BLK_BACKING_FILE) {
+                convert_account(status == BLK_DATA ? &s->write_stats :
+                                                     &s->zero_stats,
+                                n * BDRV_SECTOR_SIZE, start_ns);
+            }
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2071,6 +2136,7 @@ static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
     int64_t sector_num = 0;
+    int64_t start_ns;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (!s->has_zero_init && s->target_is_new && s->min_sparse &&
@@ -2079,15 +2145,21 @@ static int convert_do_copy(ImgConvertState *s)
     }
 
     /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+     * can be copied at a time, unless the target can compress several clusters
+     * of a request in parallel (as far as the buffer size allows). */
     if (s->compressed) {
+        int64_t clusters;
+
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        clusters = MIN(s->compress_clusters,
+                       s->buf_sectors / s->cluster_sectors);
+        s->buf_sectors = s->cluster_sectors * MAX(clusters, 1);
     }
 
+    start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
         if (n < 0) {
@@ -2099,12 +2171,16 @@ static int convert_do_copy(ImgConvertState *s)
         }
         sector_num += n;
     }
+    s->status_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
 
     /* Do the copy */
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
 
+    start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     qemu_co_mutex_init(&s->lock);
+    s->co = g_new0(Coroutine *, s->num_coroutines);
+    s->wait_sector_num = g_new(int64_t, s->num_coroutines);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
@@ -2114,6 +2190,11 @@ static int convert_do_copy(ImgConvertState *s)
     while (s->running_coroutines) {
         main_loop_wait(false);
     }
+    g_free(s->co);
+    s->co = NULL;
+    g_free(s->wait_sector_num);
+    s->wait_sector_num = NULL;
+    s->copy_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2189,6 +2270,61 @@ static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst,
     return 0;
 }
 
+/*
+ * Let qcow2 nodes among the sources and the target run more compression,
+ * decompression and encryption tasks in parallel.  Other drivers do not
+ * offload any work to threads, so they are left alone.
+ */
+static int convert_set_worker_threads(BlockBackend *blk, int64_t threads)
+{
+    BlockDriverState *bs;
+
+    for (bs = blk_bs(blk); bs; bs = bdrv_filter_or_cow_bs(bs)) {
+        Error *local_err = NULL;
+        QDict *opts;
+
+        if (g_strcmp0(bdrv_get_format_name(bs), "qcow2")) {
+            continue;
+        }
+
+        opts = qdict_new();
+        qdict_put_int(opts, "worker-threads", threads);
+        if (bdrv_reopen(bs, opts, true, &local_err) < 0) {
+            error_reportf_err(local_err, "Could not set worker threads for "
+                              "'%s': ", bs->filename);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void convert_print_op_stats(const char *name, ImgConvertOpStats *stats,
+                                   int64_t copy_ns)
+{
+    double mib = (double)stats->bytes / MiB;
+
+    printf("%-10s %10" PRId64 " %12.1f %10.1f %16.3f\n", name,
+           stats->requests, mib, copy_ns ? mib / (copy_ns / 1e9) : 0.0,
+           stats->requests ? stats->busy_ns / 1e6 / stats->requests : 0.0);
+}
+
+static void convert_print_stats(ImgConvertState *s)
+{
+    printf("%-14s %10s\n", "Phase", "Time (s)");
+    printf("%-14s %10.3f\n", "block-status", s->status_ns / 1e9);
+    printf("%-14s %10.3f\n", "copy", s->copy_ns / 1e9);
+    printf("%-14s %10.3f\n", "bitmaps", s->bitmaps_ns / 1e9);
+    printf("\n");
+
+    /* Throughput is over the whole copy phase, latency is per request */
+    printf("%-10s %10s %12s %10s %16s\n",
+           "Operation", "Requests", "MiB", "MiB/s", "Avg latency (ms)");
+    convert_print_op_stats("read", &s->read_stats, s->copy_ns);
+    convert_print_op_stats("write", &s->write_stats, s->copy_ns);
+    convert_print_op_stats("zero", &s->zero_stats, s->copy_ns);
+}
+
 #define MAX_BUF_SECTORS 32768
 
 static void set_rate_limit(BlockBackend *blk, int64_t rate_limit)
@@ -2224,7 +2360,9 @@ static int img_convert(int argc, char **argv)
     bool explict_min_sparse = false;
     bool bitmaps = false;
     bool skip_broken = false;
+    bool stats = false;
     int64_t rate_limit = 0;
+    int64_t worker_threads = 0;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2246,6 +2384,8 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"worker-threads", required_argument, 0, OPTION_WORKER_THREADS},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2380,6 +2520,16 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_WORKER_THREADS:
+            if (qemu_strtoi64(optarg, NULL, 0, &worker_threads) ||
+                worker_threads < 1) {
+                error_report("Invalid number of worker threads");
+                goto fail_getopt;
+            }
+            break;
+        case OPTION_STATS:
+            stats = true;
+            break;
         }
     }
 
@@ -2752,11 +2902,34 @@ static int img_convert(int argc, char **argv)
         set_rate_limit(s.target, rate_limit);
     }
 
+    if (worker_threads) {
+        for (bs_i = 0; bs_i < s.src_num; bs_i++) {
+            if (convert_set_worker_threads(s.src[bs_i], worker_threads) < 0) {
+                ret = -1;
+                goto out;
+            }
+        }
+        if (convert_set_worker_threads(s.target, worker_threads) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /*
+         * qcow2 compresses the clusters of a write request in parallel, so
+         * give it one cluster per thread even if writes are kept in order.
+         */
+        if (!g_strcmp0(bdrv_get_format_name(out_bs), "qcow2")) {
+            s.compress_clusters = worker_threads;
+        }
+    }
+
     ret = convert_do_copy(&s);
 
     /* Now copy the bitmaps */
     if (bitmaps && ret == 0) {
+        int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
         ret = convert_copy_bitmaps(blk_bs(s.src[0]), out_bs, skip_broken);
+        s.bitmaps_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
     }
 
 out:
@@ -2764,6 +2937,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (stats && !ret && !s.quiet) {
+        convert_print_stats(&s);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
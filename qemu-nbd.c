@@ -40,6 +40,7 @@
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "io/channel-socket.h"
 #include "io/net-listener.h"
 #include "crypto/init.h"
@@ -70,6 +71,8 @@
 #define QEMU_NBD_OPT_PID_FILE      265
 #define QEMU_NBD_OPT_SELINUX_LABEL 266
 #define QEMU_NBD_OPT_TLSHOSTNAME   267
+#define QEMU_NBD_OPT_CONN_IOTHREADS 268
+#define QEMU_NBD_OPT_ZERO_COPY     269
 
 #define MBR_SIZE 512
 
@@ -104,6 +107,8 @@ static void usage(const char *name)
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
 "  -D, --description=TEXT    export a human-readable description\n"
+"  --conn-iothreads=NUM      serve client connections from NUM I/O threads\n"
+"  --zero-copy               send read data with MSG_ZEROCOPY when possible\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET       offset into the image\n"
@@ -549,6 +554,9 @@ int main(int argc, char **argv)
         { "trace", required_argument, NULL, 'T' },
         { "fork", no_argument, NULL, QEMU_NBD_OPT_FORK },
         { "pid-file", required_argument, NULL, QEMU_NBD_OPT_PID_FILE },
+        { "conn-iothreads", required_argument, NULL,
+          QEMU_NBD_OPT_CONN_IOTHREADS },
+        { "zero-copy", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY },
         { "selinux-label", required_argument, NULL,
           QEMU_NBD_OPT_SELINUX_LABEL },
         { NULL, 0, NULL, 0 }
@@ -579,6 +587,9 @@ int main(int argc, char **argv)
     unsigned socket_activation;
     const char *pid_file_name = NULL;
     const char *selinux_label = NULL;
+    unsigned int conn_iothreads = 0;
+    strList *conn_iothread_ids = NULL;
+    bool zero_copy = false;
     BlockExportOptions *export_opts;
 
 #ifdef CONFIG_POSIX
@@ -781,6 +792,17 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_SELINUX_LABEL:
             selinux_label = optarg;
             break;
+        case QEMU_NBD_OPT_CONN_IOTHREADS:
+            if (qemu_strtoui(optarg, NULL, 0, &conn_iothreads) < 0 ||
+                conn_iothreads > 64) {
+                error_report("Invalid number of connection I/O threads '%s'",
+                             optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case QEMU_NBD_OPT_ZERO_COPY:
+            zero_copy = true;
+            break;
         }
     }
 
@@ -1097,6 +1119,15 @@ int main(int argc, char **argv)
 
     nbd_server_is_qemu_nbd(shared);
 
+    while (conn_iothreads > 0) {
+        g_autofree char *id = g_strdup_printf("qemu-nbd-conn%u",
+                                              --conn_iothreads);
+
+        object_new_with_props(TYPE_IOTHREAD, object_get_objects_root(), id,
+                              &error_fatal, NULL);
+        QAPI_LIST_PREPEND(conn_iothread_ids, g_steal_pointer(&id));
+    }
+
     export_opts = g_new(BlockExportOptions, 1);
     *export_opts = (BlockExportOptions) {
         .type               = BLOCK_EXPORT_TYPE_NBD,
@@ -1113,6 +1144,10 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .has_conn_iothreads   = !!conn_iothread_ids,
+            .conn_iothreads       = conn_iothread_ids,
+            .has_zero_copy        = zero_copy,
+            .zero_copy            = zero_copy,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
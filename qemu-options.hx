@@ -184,7 +184,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                jmp-cache-bits=n (log2 of the maximum TCG jump cache entries per vCPU)\n"
+    "                hot-threshold=n (retranslate TCG blocks run n times as traces, default 0)\n"
+    "                cached-regs=n (guest registers TCG keeps in host registers across blocks, default 0)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reap-threads=n (threads reaping the KVM dirty rings, default 0)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -219,6 +223,33 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``jmp-cache-bits=n``
+        Sets the maximum size of the per-vCPU TCG jump cache to 2^n
+        entries, with n between 8 and 18.  In system emulation the cache
+        starts with at most 4096 entries and grows or shrinks on TLB
+        flushes depending on how much of it is in use; the default
+        maximum is 16.  In user mode emulation the cache always has 2^n
+        entries, 12 by default.  ``info jit`` shows the current size and
+        the hit rate of each vCPU's cache.
+
+    ``hot-threshold=n``
+        Counts the executions of each TCG translation block and, once a
+        block has run n times, translates it again as a trace that
+        continues through direct jumps instead of ending at them.  The
+        default of 0 disables this.  Only targets that support traces
+        (currently x86) count executions.  ``info jit`` shows how many
+        traces were translated.
+
+    ``cached-regs=n``
+        Keeps up to n frequently used guest registers in host registers
+        when one TCG translation block jumps directly to the next, so
+        that the next block does not need to load them again.  The
+        values are still written back to the CPU state.  The number of
+        host registers set aside for this, and which guest registers are
+        used, depend on the host and the target (currently x86 guests on
+        x86-64 and AArch64 hosts, which set aside 4).  Larger values
+        are rejected.  The default of 0 disables this.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -237,6 +268,13 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reap-threads=n``
+        When the KVM dirty ring is enabled, the rings of all vCPUs are
+        reaped by the thread that syncs the dirty log.  With n greater than
+        0, n helper threads reap the rings of different vCPUs in parallel,
+        which shortens each dirty log sync for guests with many vCPUs.
+        Default: dirty-ring-reap-threads=0.
+
     ``notify-vmexit=run|internal-error|disable,notify-window=n``
         Enables or disables notify VM exit support on x86 host and specify
         the corresponding notify window to trigger the VM exit if enabled.
@@ -4548,6 +4586,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4567,6 +4607,10 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a file written by ``migrate
+    file:filename``.  The source must have finished writing it.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
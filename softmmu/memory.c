@@ -3074,12 +3074,23 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    as->bounce_buffer_peak = 0;
+    as->bounce_buffer_maps = 0;
+    as->bounce_buffer_failures = 0;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
 }
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(qatomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -3447,6 +3458,15 @@ static void mtree_print_as_name(gpointer data, gpointer user_data)
     AddressSpace *as = data;
 
     qemu_printf("address-space: %s\n", as->name);
+    if (qatomic_read(&as->bounce_buffer_maps)) {
+        qemu_printf("  bounce buffers: %zu/%zu bytes in use, peak %zu, "
+                    "%" PRIu64 " maps, %" PRIu64 " failed\n",
+                    qatomic_read(&as->bounce_buffer_size),
+                    as->max_bounce_buffer_size,
+                    qatomic_read(&as->bounce_buffer_peak),
+                    qatomic_read(&as->bounce_buffer_maps),
+                    qatomic_read(&as->bounce_buffer_failures));
+    }
 }
 
 static void mtree_print_as(gpointer key, gpointer value, gpointer user_data)
@@ -2920,6 +2920,27 @@ static void gen_jmp_rel_csize(DisasContext *s, int diff, int tb_num)
     gen_jmp_rel(s, CODE32(s) ? MO_32 : MO_16, diff, tb_num);
 }
 
+/*
+ * Jump to eip+diff for an unconditional direct jump.  When translating a
+ * trace, continue with the destination in the same TB instead; nothing is
+ * emitted then, and in particular cc_op stays known across the jump.
+ */
+static void gen_jmp_rel_trace(DisasContext *s, MemOp ot, int diff)
+{
+    target_ulong new_pc = s->pc + diff;
+    target_ulong new_eip = new_pc - s->cs_base;
+
+    if (!CODE64(s)) {
+        new_eip &= ot == MO_16 ? 0xffff : 0xffffffff;
+    }
+    if (s->jmp_opt && new_eip + s->cs_base == new_pc &&
+        translator_trace_follow(&s->base, s->pc, new_pc)) {
+        s->pc = new_pc;
+        return;
+    }
+    gen_jmp_rel(s, ot, diff, 0);
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEUQ);
@@ -5084,7 +5105,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
                         : (int16_t)insn_get(env, s, MO_16));
             gen_push_v(s, eip_next_tl(s));
             gen_bnd_jmp(s);
-            gen_jmp_rel(s, dflag, diff, 0);
+            gen_jmp_rel_trace(s, dflag, diff);
         }
         break;
     case 0x9a: /* lcall im */
@@ -5107,7 +5128,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
                         ? (int32_t)insn_get(env, s, MO_32)
                         : (int16_t)insn_get(env, s, MO_16));
             gen_bnd_jmp(s);
-            gen_jmp_rel(s, dflag, diff, 0);
+            gen_jmp_rel_trace(s, dflag, diff);
         }
         break;
     case 0xea: /* ljmp im */
@@ -5127,7 +5148,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
     case 0xeb: /* jmp Jb */
         {
             int diff = (int8_t)insn_get(env, s, MO_8);
-            gen_jmp_rel(s, dflag, diff, 0);
+            gen_jmp_rel_trace(s, dflag, diff);
         }
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
@@ -6860,6 +6881,10 @@ void tcg_x86_init(void)
     static const char bnd_regu_names[4][8] = {
         "bnd0_ub", "bnd1_ub", "bnd2_ub", "bnd3_ub"
     };
+    /* Kept in host registers across chained TBs, in order of preference. */
+    static const int cached_regs[] = {
+        R_ESP, R_EAX, R_ECX, R_EDX, R_ESI, R_EDI,
+    };
     int i;
 
     cpu_cc_op = tcg_global_mem_new_i32(cpu_env,
@@ -6877,6 +6902,11 @@ void tcg_x86_init(void)
                                          offsetof(CPUX86State, regs[i]),
                                          reg_names[i]);
     }
+    for (i = 0; i < ARRAY_SIZE(cached_regs); ++i) {
+        if (!tcg_global_cache_tl(cpu_regs[cached_regs[i]])) {
+            break;
+        }
+    }
 
     for (i = 0; i < 6; ++i) {
         cpu_seg_base[i]
@@ -7063,6 +7093,7 @@ static const TranslatorOps i386_tr_ops = {
     .translate_insn     = i386_tr_translate_insn,
     .tb_stop            = i386_tr_tb_stop,
     .disas_log          = i386_tr_disas_log,
+    .can_trace          = true,
 };
 
 /* generate intermediate code for basic block 'tb'.  */
@@ -91,6 +91,11 @@ typedef enum {
     TCG_REG_CALL_STACK = TCG_REG_ESP
 } TCGReg;
 
+/* call-saved registers that can hold globals across chained TBs */
+#if TCG_TARGET_REG_BITS == 64
+#define TCG_TARGET_NB_CACHED_REGS 4
+#endif
+
 /* used for function call generation */
 #define TCG_TARGET_STACK_ALIGN 16
 #if defined(_WIN64)
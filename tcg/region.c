@@ -28,6 +28,7 @@
 #include "qemu/mprotect.h"
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
@@ -60,6 +61,16 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+    /*
+     * Once every region has been handed out, tcg_region_evict() recycles
+     * the oldest ones instead of flushing the whole buffer.
+     */
+    uint64_t next_gen;
+    uint64_t *gen; /* value of next_gen when the region was handed out */
+    size_t *size_full; /* contribution of the region to agg_size_full */
+    unsigned long *free; /* evicted regions, available for allocation */
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
@@ -167,10 +178,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Index of the region containing @p, which must be in the rw buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -182,18 +206,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
         }
     }
 
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -287,6 +300,28 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+/*
+ * tcg_tb_alloc() places TBs at least one aligned TranslationBlock apart,
+ * so their offset in the buffer gives a dense index for per-TB data that
+ * is kept outside of it.
+ */
+static size_t tcg_tb_stride(void)
+{
+    return ROUND_UP(sizeof(TranslationBlock), qemu_icache_linesize);
+}
+
+size_t tcg_tb_index(const TranslationBlock *tb)
+{
+    tcg_debug_assert(in_code_gen_buffer(tb));
+    return ((const void *)tb - region.start_aligned) / tcg_tb_stride();
+}
+
+/* Upper bound (exclusive) of tcg_tb_index(), valid after tcg_init() */
+size_t tcg_tb_index_max(void)
+{
+    return region.total_size / tcg_tb_stride() + 1;
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -335,11 +370,19 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i;
+
+    if (region.current < region.n) {
+        i = region.current++;
+    } else if (region.n_free) {
+        i = find_first_bit(region.free, region.n);
+        clear_bit(i, region.free);
+        region.n_free--;
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
+    region.gen[i] = region.next_gen++;
     return false;
 }
 
@@ -352,11 +395,13 @@ bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.size_full[full] = size_full - TCG_HIGHWATER;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -388,6 +433,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    bitmap_zero(region.free, region.n);
+    region.n_free = 0;
+    memset(region.size_full, 0, region.n * sizeof(*region.size_full));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -398,6 +446,72 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static int tcg_region_gen_cmp(const void *ap, const void *bp)
+{
+    uint64_t a = region.gen[*(const size_t *)ap];
+    uint64_t b = region.gen[*(const size_t *)bp];
+
+    return a < b ? -1 : a > b;
+}
+
+/*
+ * Call from a safe-work context, once tcg_region_alloc() has failed.
+ *
+ * Pick the oldest of the regions that are not being filled by any TCG
+ * context, call @func on each TB in them and make them available for
+ * allocation again.  @func must unlink the TB from everything that might
+ * still point to it; the region trees are reset here.
+ *
+ * Returns the number of regions evicted, which is 0 when there is nothing
+ * to evict and the caller has to fall back to tcg_region_reset_all().
+ * A region that another context evicted in the meantime counts as well.
+ */
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree unsigned long *in_use = bitmap_new(region.n);
+    g_autofree size_t *victims = g_new(size_t, region.n);
+    size_t i, n_victims = 0, n_evict;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_free || region.current < region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return 1;
+    }
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        set_bit(tcg_region_index(s->code_gen_buffer), in_use);
+    }
+    for (i = 0; i < region.n; i++) {
+        if (!test_bit(i, in_use)) {
+            victims[n_victims++] = i;
+        }
+    }
+    qsort(victims, n_victims, sizeof(*victims), tcg_region_gen_cmp);
+
+    /* Evict a quarter of the buffer, so that evictions stay infrequent */
+    n_evict = MIN(n_victims, DIV_ROUND_UP(region.n, 4));
+    for (i = 0; i < n_evict; i++) {
+        struct tcg_region_tree *rt = region_trees + victims[i] * tree_size;
+
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, func, user_data);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        region.agg_size_full -= region.size_full[victims[i]];
+        region.size_full[victims[i]] = 0;
+        set_bit(victims[i], region.free);
+        region.n_free++;
+    }
+    qemu_mutex_unlock(&region.lock);
+    return n_evict;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -411,9 +525,13 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /*
+     * A single vCPU thread does not contend for regions, but a few of them
+     * still let tcg_region_evict() recycle old code instead of flushing
+     * the whole buffer.
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return MAX(MIN(tb_size / (2 * MiB), 8), 1);
     }
 
     /*
@@ -710,7 +828,8 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG we use up to 8 regions of at
+ * least 2 MB, so that tcg_region_evict() has old regions to recycle.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -786,6 +905,9 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.gen = g_new0(uint64_t, region.n);
+    region.size_full = g_new0(size_t, region.n);
+    region.free = bitmap_new(region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
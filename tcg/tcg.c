@@ -159,6 +159,7 @@ TCGContext **tcg_ctxs;
 unsigned int tcg_cur_ctxs;
 unsigned int tcg_max_ctxs;
 TCGv_env cpu_env = 0;
+unsigned int tcg_cached_regs_max;
 const void *tcg_code_gen_epilogue;
 uintptr_t tcg_splitwx_diff;
 
@@ -1104,6 +1105,42 @@ TCGTemp *tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
     return ts;
 }
 
+/*
+ * Ask for the global @ts to stay in a host register across TBs that are
+ * chained with goto_tb, so that the next TB does not reload it from memory.
+ * Only the first tcg_cached_regs_max globals are cached, which the accel
+ * property limits to the number of registers the backend sets aside; for
+ * the others this returns false.
+ * All TBs rely on the same assignment, so this must be called while the
+ * target creates its globals, before any code is generated.
+ */
+bool tcg_global_cache(TCGTemp *ts)
+{
+#if TCG_TARGET_NB_CACHED_REGS
+    TCGContext *s = tcg_ctx;
+    TCGReg reg;
+
+    tcg_debug_assert(ts->kind == TEMP_GLOBAL);
+    if (ts->cached) {
+        return true;
+    }
+    tcg_debug_assert(tcg_cached_regs_max <= TCG_TARGET_NB_CACHED_REGS);
+    if (ts->indirect_reg || ts->type > TCG_TYPE_REG
+        || s->nb_cached_globals >= tcg_cached_regs_max) {
+        return false;
+    }
+
+    reg = tcg_target_cached_regs[s->nb_cached_globals++];
+    tcg_debug_assert(!tcg_regset_test_reg(s->reserved_regs, reg));
+    tcg_regset_set_reg(s->cached_regs, reg);
+    ts->cached = 1;
+    ts->cached_reg = reg;
+    return true;
+#else
+    return false;
+#endif
+}
+
 TCGTemp *tcg_temp_new_internal(TCGType type, bool temp_local)
 {
     TCGContext *s = tcg_ctx;
@@ -1638,6 +1675,7 @@ bool tcg_op_supported(TCGOpcode op)
 }
 
 static TCGOp *tcg_op_alloc(TCGOpcode opc, unsigned nargs);
+static void tcg_insert_op(TCGContext *s, TCGOp *op);
 
 void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args)
 {
@@ -1712,7 +1750,7 @@ void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args)
     op->args[pi++] = (uintptr_t)info;
     tcg_debug_assert(pi == total_args);
 
-    QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    tcg_insert_op(tcg_ctx, op);
 
     tcg_debug_assert(n_extend < ARRAY_SIZE(extend_free));
     for (i = 0; i < n_extend; ++i) {
@@ -1751,6 +1789,27 @@ static void tcg_reg_alloc_start(TCGContext *s)
     }
 
     memset(s->reg_to_temp, 0, sizeof(s->reg_to_temp));
+
+    /*
+     * The TB is entered either through a goto_tb, which leaves the cached
+     * globals in their registers, or after tcg_out_ld_cached_globals.
+     */
+    s->cached_valid_regs = s->cached_regs;
+}
+
+/* Load the cached globals, for TBs not entered through a goto_tb. */
+static void tcg_out_ld_cached_globals(TCGContext *s)
+{
+    int i, n;
+
+    for (i = 0, n = s->nb_globals; i < n && s->cached_regs; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->cached) {
+            tcg_out_ld(s, ts->type, ts->cached_reg,
+                       ts->mem_base->reg, ts->mem_offset);
+        }
+    }
 }
 
 static char *tcg_get_arg_str_ptr(TCGContext *s, char *buf, int buf_size,
@@ -2438,10 +2497,21 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc, unsigned nargs)
     return op;
 }
 
+static void tcg_insert_op(TCGContext *s, TCGOp *op)
+{
+#ifdef CONFIG_PLUGIN
+    if (unlikely(s->emit_before_op)) {
+        QTAILQ_INSERT_BEFORE(s->emit_before_op, op, link);
+        return;
+    }
+#endif
+    QTAILQ_INSERT_TAIL(&s->ops, op, link);
+}
+
 TCGOp *tcg_emit_op(TCGOpcode opc, unsigned nargs)
 {
     TCGOp *op = tcg_op_alloc(opc, nargs);
-    QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    tcg_insert_op(tcg_ctx, op);
     return op;
 }
 
@@ -2571,6 +2641,23 @@ static void la_func_end(TCGContext *s, int ng, int nt)
     }
 }
 
+/* liveness analysis: goto_tb: cached globals are also expected in their
+   register by the next TB. */
+static void la_goto_tb(TCGContext *s, int ng)
+{
+    int i;
+
+    for (i = 0; i < ng && s->nb_cached_globals; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->cached) {
+            ts->state = TS_MEM;
+            *la_temp_pref(ts) = 0;
+            tcg_regset_set_reg(*la_temp_pref(ts), ts->cached_reg);
+        }
+    }
+}
+
 /* liveness analysis: end of basic block: all temps are dead, globals
    and local temps should be in memory. */
 static void la_bb_end(TCGContext *s, int ng, int nt)
@@ -2954,6 +3041,9 @@ static void liveness_pass_1(TCGContext *s)
             /* If end of basic block, update.  */
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
+                if (opc == INDEX_op_goto_tb) {
+                    la_goto_tb(s, nb_globals);
+                }
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
                 la_bb_sync(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
@@ -3257,7 +3347,23 @@ static void temp_allocate_frame(TCGContext *s, TCGTemp *ts)
     ts->mem_allocated = 1;
 }
 
-/* Assign @reg to @ts, and update reg_to_temp[]. */
+/*
+ * @ts leaves its register.  If that is the register of a cached global that
+ * holds a value not yet stored to memory, the register is no longer valid.
+ */
+static void temp_leave_reg(TCGContext *s, TCGTemp *ts)
+{
+    if (ts->cached && ts->reg == ts->cached_reg && !ts->mem_coherent) {
+        tcg_regset_reset_reg(s->cached_valid_regs, ts->reg);
+    }
+}
+
+/*
+ * Assign @reg to @ts, and update reg_to_temp[].  Not every caller goes
+ * through tcg_reg_alloc(): outputs may take over the register of an input
+ * that dies, so a cached register handed to any temp but its own global no
+ * longer holds that global.
+ */
 static void set_temp_val_reg(TCGContext *s, TCGTemp *ts, TCGReg reg)
 {
     if (ts->val_type == TEMP_VAL_REG) {
@@ -3266,9 +3372,13 @@ static void set_temp_val_reg(TCGContext *s, TCGTemp *ts, TCGReg reg)
         if (old == reg) {
             return;
         }
+        temp_leave_reg(s, ts);
         s->reg_to_temp[old] = NULL;
     }
     tcg_debug_assert(s->reg_to_temp[reg] == NULL);
+    if (!(ts->cached && ts->cached_reg == reg)) {
+        tcg_regset_reset_reg(s->cached_valid_regs, reg);
+    }
     s->reg_to_temp[reg] = ts;
     ts->val_type = TEMP_VAL_REG;
     ts->reg = reg;
@@ -3281,6 +3391,7 @@ static void set_temp_val_nonreg(TCGContext *s, TCGTemp *ts, TCGTempVal type)
     if (ts->val_type == TEMP_VAL_REG) {
         TCGReg reg = ts->reg;
         tcg_debug_assert(s->reg_to_temp[reg] == ts);
+        temp_leave_reg(s, ts);
         s->reg_to_temp[reg] = NULL;
     }
     ts->val_type = type;
@@ -3339,6 +3450,10 @@ static void temp_sync(TCGContext *s, TCGTemp *ts, TCGRegSet allocated_regs,
             if (free_or_dead
                 && tcg_out_sti(s, ts->type, ts->val,
                                ts->mem_base->reg, ts->mem_offset)) {
+                if (ts->cached) {
+                    tcg_regset_reset_reg(s->cached_valid_regs,
+                                         ts->cached_reg);
+                }
                 break;
             }
             temp_load(s, ts, tcg_target_available_regs[ts->type],
@@ -3348,6 +3463,14 @@ static void temp_sync(TCGContext *s, TCGTemp *ts, TCGRegSet allocated_regs,
         case TEMP_VAL_REG:
             tcg_out_st(s, ts->type, ts->reg,
                        ts->mem_base->reg, ts->mem_offset);
+            if (ts->cached) {
+                if (ts->reg == ts->cached_reg) {
+                    tcg_regset_set_reg(s->cached_valid_regs, ts->reg);
+                } else {
+                    tcg_regset_reset_reg(s->cached_valid_regs,
+                                         ts->cached_reg);
+                }
+            }
             break;
 
         case TEMP_VAL_MEM:
@@ -3373,6 +3496,13 @@ static void tcg_reg_free(TCGContext *s, TCGReg reg, TCGRegSet allocated_regs)
     }
 }
 
+/* @reg is about to be overwritten, so it no longer holds a cached global. */
+static inline TCGReg tcg_reg_clobber(TCGContext *s, TCGReg reg)
+{
+    tcg_regset_reset_reg(s->cached_valid_regs, reg);
+    return reg;
+}
+
 /**
  * tcg_reg_alloc:
  * @required_regs: Set of registers in which we must allocate.
@@ -3387,7 +3517,7 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet required_regs,
                             TCGRegSet allocated_regs,
                             TCGRegSet preferred_regs, bool rev)
 {
-    int i, j, f, n = ARRAY_SIZE(tcg_target_reg_alloc_order);
+    int i, j, k, f, n = ARRAY_SIZE(tcg_target_reg_alloc_order);
     TCGRegSet reg_ct[2];
     const int *order;
 
@@ -3401,22 +3531,28 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet required_regs,
 
     order = rev ? indirect_reg_alloc_order : tcg_target_reg_alloc_order;
 
-    /* Try free registers, preferences first.  */
+    /* Try free registers, preferences first.  Among those, keep the
+       registers that still hold a cached global for last.  */
     for (j = f; j < 2; j++) {
         TCGRegSet set = reg_ct[j];
+        TCGRegSet avoid = set & s->cached_valid_regs;
 
         if (tcg_regset_single(set)) {
             /* One register in the set.  */
             TCGReg reg = tcg_regset_first(set);
             if (s->reg_to_temp[reg] == NULL) {
-                return reg;
+                return tcg_reg_clobber(s, reg);
             }
         } else {
-            for (i = 0; i < n; i++) {
-                TCGReg reg = order[i];
-                if (s->reg_to_temp[reg] == NULL &&
-                    tcg_regset_test_reg(set, reg)) {
-                    return reg;
+            for (k = avoid && avoid != set ? 0 : 1; k < 2; k++) {
+                TCGRegSet kset = k ? set : set & ~avoid;
+
+                for (i = 0; i < n; i++) {
+                    TCGReg reg = order[i];
+                    if (s->reg_to_temp[reg] == NULL &&
+                        tcg_regset_test_reg(kset, reg)) {
+                        return tcg_reg_clobber(s, reg);
+                    }
                 }
             }
         }
@@ -3430,13 +3566,13 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet required_regs,
             /* One register in the set.  */
             TCGReg reg = tcg_regset_first(set);
             tcg_reg_free(s, reg, allocated_regs);
-            return reg;
+            return tcg_reg_clobber(s, reg);
         } else {
             for (i = 0; i < n; i++) {
                 TCGReg reg = order[i];
                 if (tcg_regset_test_reg(set, reg)) {
                     tcg_reg_free(s, reg, allocated_regs);
-                    return reg;
+                    return tcg_reg_clobber(s, reg);
                 }
             }
         }
@@ -3482,7 +3618,8 @@ static TCGReg tcg_reg_alloc_pair(TCGContext *s, TCGRegSet required_regs,
                     if (f >= fmin) {
                         tcg_reg_free(s, reg, allocated_regs);
                         tcg_reg_free(s, reg + 1, allocated_regs);
-                        return reg;
+                        tcg_reg_clobber(s, reg + 1);
+                        return tcg_reg_clobber(s, reg);
                     }
                 }
             }
@@ -3528,9 +3665,22 @@ static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
         ts->mem_coherent = 0;
         break;
     case TEMP_VAL_MEM:
+        if (ts->cached
+            && tcg_regset_test_reg(s->cached_valid_regs, ts->cached_reg)
+            && tcg_regset_test_reg(desired_regs & ~allocated_regs,
+                                   ts->cached_reg)) {
+            /* The register still holds the value in memory.  */
+            reg = ts->cached_reg;
+            tcg_debug_assert(s->reg_to_temp[reg] == NULL);
+            ts->mem_coherent = 1;
+            break;
+        }
         reg = tcg_reg_alloc(s, desired_regs, allocated_regs,
                             preferred_regs, ts->indirect_base);
         tcg_out_ld(s, ts->type, reg, ts->mem_base->reg, ts->mem_offset);
+        if (ts->cached && reg == ts->cached_reg) {
+            tcg_regset_set_reg(s->cached_valid_regs, reg);
+        }
         ts->mem_coherent = 1;
         break;
     case TEMP_VAL_DEAD:
@@ -3638,6 +3788,89 @@ static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/*
+ * At goto_tb, put each cached global in its register and sync it, which is
+ * what the chain entry of the next TB expects.  The globals are then back
+ * in memory as far as the rest of this TB is concerned.  Nothing needs to
+ * be emitted for a global whose register still holds the value in memory,
+ * which is the case unless the TB wrote the global, called a helper that
+ * may write it, or needed the register for something else.
+ */
+static void tcg_reg_alloc_goto_tb(TCGContext *s)
+{
+    TCGRegSet allocated_regs = s->reserved_regs;
+    int i, n;
+
+    if (!s->nb_cached_globals) {
+        return;
+    }
+
+    for (i = 0, n = s->nb_globals; i < n; i++) {
+        TCGTemp *ts = &s->temps[i];
+        TCGReg reg = ts->cached_reg;
+
+        if (!ts->cached) {
+            continue;
+        }
+        if ((ts->val_type == TEMP_VAL_MEM
+             || (ts->val_type == TEMP_VAL_REG && ts->mem_coherent))
+            && tcg_regset_test_reg(s->cached_valid_regs, reg)) {
+            tcg_regset_set_reg(allocated_regs, reg);
+            continue;
+        }
+        if (ts->val_type != TEMP_VAL_REG || ts->reg != reg) {
+            tcg_reg_free(s, reg, allocated_regs);
+            if (ts->val_type == TEMP_VAL_REG) {
+                if (!tcg_out_mov(s, ts->type, reg, ts->reg)) {
+                    /* Cached globals are integers, which can always move. */
+                    g_assert_not_reached();
+                }
+                set_temp_val_reg(s, ts, reg);
+            } else {
+                TCGRegSet desired_regs = 0;
+
+                tcg_regset_set_reg(desired_regs, reg);
+                temp_load(s, ts, desired_regs, allocated_regs, 0);
+            }
+        }
+        temp_sync(s, ts, allocated_regs, 0, 0);
+        tcg_regset_set_reg(s->cached_valid_regs, reg);
+        tcg_regset_set_reg(allocated_regs, reg);
+    }
+
+    for (i = 0, n = s->nb_globals; i < n; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->cached) {
+            temp_free_or_dead(s, ts, -1);
+        }
+    }
+}
+
+/* Record the cached registers that are valid on a branch to @l.  */
+static void tcg_reg_alloc_branch_to(TCGContext *s, TCGLabel *l)
+{
+    if (l->seen_refs++ == 0) {
+        l->cached_valid = s->cached_valid_regs;
+    } else {
+        l->cached_valid &= s->cached_valid_regs;
+    }
+}
+
+/*
+ * At a label, a cached register is valid only if it is on every path that
+ * reaches it.  Ops are allocated in order, so a label that has not seen all
+ * of its branches yet is the target of a backward one and nothing is known.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, TCGLabel *l)
+{
+    if (l->seen_refs < l->refs) {
+        s->cached_valid_regs = 0;
+    } else if (l->seen_refs) {
+        s->cached_valid_regs &= l->cached_valid;
+    }
+}
+
 /*
  * Specialized code generation for INDEX_op_mov_* with a constant.
  */
@@ -4389,6 +4622,8 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
         sync_globals(s, allocated_regs);
     } else {
         save_globals(s, allocated_regs);
+        /* The helper may change the globals behind the cached registers. */
+        s->cached_valid_regs = 0;
     }
 
     tcg_out_call(s, tcg_call_func(op), info);
@@ -4664,6 +4899,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
     s->code_buf = tcg_splitwx_to_rw(tb->tc.ptr);
     s->code_ptr = s->code_buf;
 
+    /* Direct jumps from other TBs skip the loads of the cached globals.  */
+    tcg_out_ld_cached_globals(s);
+    tb->jmp_entry_offset = tcg_current_code_size(s);
+
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_INIT(&s->ldst_labels);
 #endif
@@ -4711,11 +4950,29 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
             break;
         case INDEX_op_set_label:
             tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_label(s, arg_label(op->args[0]));
             tcg_out_label(s, arg_label(op->args[0]));
             break;
+        case INDEX_op_br:
+            tcg_reg_alloc_op(s, op);
+            tcg_reg_alloc_branch_to(s, arg_label(op->args[0]));
+            break;
+        case INDEX_op_brcond_i32:
+        case INDEX_op_brcond_i64:
+            tcg_reg_alloc_op(s, op);
+            tcg_reg_alloc_branch_to(s, arg_label(op->args[3]));
+            break;
+        case INDEX_op_brcond2_i32:
+            tcg_reg_alloc_op(s, op);
+            tcg_reg_alloc_branch_to(s, arg_label(op->args[5]));
+            break;
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
             break;
+        case INDEX_op_goto_tb:
+            tcg_reg_alloc_goto_tb(s);
+            tcg_reg_alloc_op(s, op);
+            break;
         case INDEX_op_dup2_vec:
             if (tcg_reg_alloc_dup2(s, op)) {
                 break;
@@ -0,0 +1,54 @@
+/*
+ * QEMU buffer_is_zero speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+static const size_t sizes[] = { 64, 256, 1 * KiB, 4 * KiB, 64 * KiB, 1 * MiB };
+
+static void test_bufferiszero_speed(void)
+{
+    const size_t total = 1 * GiB;
+    int accel = 0;
+    void *buf;
+
+    /* Zero pages are the common case in migration and qemu-img convert */
+    buf = qemu_memalign(64, sizes[ARRAY_SIZE(sizes) - 1]);
+    memset(buf, 0, sizes[ARRAY_SIZE(sizes) - 1]);
+
+    /*
+     * test_buffer_is_zero_next_accel() walks the accelerators from the
+     * most to the least preferred, ending with the plain integer version.
+     */
+    do {
+        for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+            size_t remain;
+
+            g_test_timer_start();
+            for (remain = total; remain >= sizes[i]; remain -= sizes[i]) {
+                g_assert(buffer_is_zero(buf, sizes[i]));
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("buffer_is_zero(accel %d): buffer %zu bytes "
+                           "%.2f MB/sec", accel, sizes[i],
+                           (total - remain) / MiB / g_test_timer_last());
+        }
+        accel++;
+    } while (test_buffer_is_zero_next_accel());
+
+    qemu_vfree(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bufferiszero/benchmark/speed", test_bufferiszero_speed);
+
+    return g_test_run();
+}
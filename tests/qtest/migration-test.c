@@ -1524,6 +1524,156 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_dedup_start(QTestState *from,
+                         QTestState *to)
+{
+    migrate_set_capability(from, "dedup-pages", true);
+
+    return NULL;
+}
+
+static void
+test_migrate_dedup_finish(QTestState *from,
+                          QTestState *to,
+                          void *opaque)
+{
+    /*
+     * The guest sets the first byte of every page of its test memory to
+     * the same value, so many of the pages sent while it is stopped have
+     * been sent before.
+     */
+    g_assert_cmpint(read_ram_property_int(from, "dedup-pages"), >, 0);
+}
+
+static void test_precopy_unix_dedup(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+
+        .start_hook = test_migrate_dedup_start,
+        .finish_hook = test_migrate_dedup_finish,
+    };
+
+    test_precopy_common(&args);
+}
+
+#ifdef CONFIG_ZSTD
+static void *
+test_migrate_compress_zstd_start(QTestState *from,
+                                 QTestState *to)
+{
+    migrate_set_parameter_int(from, "compress-level", 1);
+    migrate_set_parameter_int(from, "compress-threads", 4);
+    migrate_set_parameter_str(from, "compress-method", "zstd");
+    migrate_set_parameter_int(to, "decompress-threads", 4);
+    migrate_set_parameter_str(to, "compress-method", "zstd");
+
+    migrate_set_capability(from, "compress", true);
+    migrate_set_capability(to, "compress", true);
+
+    return NULL;
+}
+
+static void
+test_migrate_compress_finish(QTestState *from,
+                             QTestState *to,
+                             void *opaque)
+{
+    QDict *rsp = migrate_query(from);
+    QDict *compression = qdict_get_qdict(rsp, "compression");
+
+    g_assert(compression);
+    g_assert_cmpint(qdict_get_int(compression, "pages"), >, 0);
+    qobject_unref(rsp);
+}
+
+static void test_precopy_unix_compress_zstd(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+
+        .start_hook = test_migrate_compress_zstd_start,
+        .finish_hook = test_migrate_compress_finish,
+
+        .iterations = 2,
+    };
+
+    test_precopy_common(&args);
+}
+
+static off_t file_size(const char *filename)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", tmpfs, filename);
+    struct stat st;
+
+    g_assert_cmpint(stat(path, &st), ==, 0);
+    return st.st_size;
+}
+
+/*
+ * Take two snapshots of the source into files that share a page store,
+ * and restore the second one on the destination.
+ */
+static void test_precopy_file_page_store(void)
+{
+    g_autofree char *store = g_strdup_printf("%s/page-store", tmpfs);
+    g_autofree char *uri1 = g_strdup_printf("file:%s/snapshot1", tmpfs);
+    g_autofree char *uri2 = g_strdup_printf("file:%s/snapshot2", tmpfs);
+    MigrateStart args = {};
+    QTestState *from, *to;
+    off_t store_size1, store_size2;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_parameter_str(from, "page-store", store);
+    migrate_set_parameter_str(to, "page-store", store);
+    migrate_ensure_converge(from);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri1, "{}");
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    store_size1 = file_size("page-store");
+
+    /* Let the guest change its memory, then take the second snapshot */
+    qtest_qmp_assert_success(from, "{ 'execute': 'cont' }");
+    usleep(1000 * 200);
+    migrate_qmp(from, uri2, "{}");
+    wait_for_migration_complete(from);
+    store_size2 = file_size("page-store");
+
+    /*
+     * Most pages of the second snapshot were already in the store, and
+     * the stream itself only says where each page is.
+     */
+    g_assert_cmpint(read_ram_property_int(from, "dedup-pages"), >, 0);
+    g_assert_cmpint(store_size2 - store_size1, <, store_size1);
+    g_assert_cmpint(file_size("snapshot2"), <, 4 * 1024 * 1024);
+
+    qtest_qmp_assert_success(to, "{ 'execute': 'migrate-incoming',"
+                                 "  'arguments': { 'uri': %s }}", uri2);
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+
+    cleanup("page-store");
+    cleanup("snapshot1");
+    cleanup("snapshot2");
+}
+#endif /* CONFIG_ZSTD */
+
 static void test_precopy_tcp_plain(void)
 {
     MigrateCommon args = {
@@ -1895,6 +2045,22 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_zero_page_legacy_start(QTestState *from,
+                                                        QTestState *to)
+{
+    migrate_set_parameter_str(from, "zero-page-detection", "legacy");
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_no_zero_page_start(QTestState *from,
+                                                    QTestState *to)
+{
+    migrate_set_parameter_str(from, "zero-page-detection", "none");
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -1909,8 +2075,25 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 {
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zstd");
 }
+
+static void *
+test_migrate_precopy_tcp_multifd_zstd_dict_start(QTestState *from,
+                                                 QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-zstd-dict-size", 16 * 1024);
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "zstd");
+}
 #endif /* CONFIG_ZSTD */
 
+#ifdef CONFIG_LZ4
+static void *
+test_migrate_precopy_tcp_multifd_lz4_start(QTestState *from,
+                                           QTestState *to)
+{
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "lz4");
+}
+#endif /* CONFIG_LZ4 */
+
 static void test_multifd_tcp_none(void)
 {
     MigrateCommon args = {
@@ -1920,6 +2103,24 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page_legacy(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zero_page_legacy_start,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_no_zero_page(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_no_zero_page_start,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -1938,6 +2139,26 @@ static void test_multifd_tcp_zstd(void)
     };
     test_precopy_common(&args);
 }
+
+static void test_multifd_tcp_zstd_dict(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zstd_dict_start,
+    };
+    test_precopy_common(&args);
+}
+#endif
+
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_lz4_start,
+    };
+    test_precopy_common(&args);
+}
 #endif
 
 #ifdef CONFIG_GNUTLS
@@ -2508,6 +2729,13 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/unix/dedup", test_precopy_unix_dedup);
+#ifdef CONFIG_ZSTD
+    qtest_add_func("/migration/precopy/unix/compress/zstd",
+                   test_precopy_unix_compress_zstd);
+    qtest_add_func("/migration/precopy/file/page-store",
+                   test_precopy_file_page_store);
+#endif
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/precopy/unix/tls/psk",
                    test_precopy_unix_tls_psk);
@@ -2572,6 +2800,10 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/plain/none",
                    test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/plain/zero-page/legacy",
+                   test_multifd_tcp_zero_page_legacy);
+    qtest_add_func("/migration/multifd/tcp/plain/zero-page/none",
+                   test_multifd_tcp_no_zero_page);
     qtest_add_func("/migration/multifd/tcp/plain/cancel",
                    test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
@@ -2579,6 +2811,12 @@ int main(int argc, char **argv)
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/plain/zstd",
                    test_multifd_tcp_zstd);
+    qtest_add_func("/migration/multifd/tcp/plain/zstd/dict",
+                   test_multifd_tcp_zstd_dict);
+#endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/plain/lz4",
+                   test_multifd_tcp_lz4);
 #endif
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/multifd/tcp/tls/psk/match",
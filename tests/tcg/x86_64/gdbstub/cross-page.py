@@ -0,0 +1,75 @@
+from __future__ import print_function
+#
+# Check the jump counters of "info jit" after the cross-page test has
+# run its loops: jumps into TBs that span two pages must have been
+# linked, and the remaps must have made some of their page checks fail.
+#
+# This is launched via tests/guest-debug/run-test.py
+#
+
+import gdb
+import re
+import sys
+
+failcount = 0
+
+
+def report(cond, msg):
+    "Report success/fail of test"
+    if cond:
+        print("PASS: %s" % (msg))
+    else:
+        print("FAIL: %s" % (msg))
+        global failcount
+        failcount += 1
+
+
+def run_test():
+    "Run through the tests one by one"
+
+    cbp = gdb.Breakpoint("_exit", gdb.BP_BREAKPOINT)
+    bp = gdb.Breakpoint("loops_done", gdb.BP_BREAKPOINT)
+    gdb.execute("c")
+    report(bp.hit_count == 1, "reached loops_done")
+
+    info = gdb.execute("monitor info jit", False, True)
+    m = re.search(r"vCPU 0 direct jumps (\d+) linked \((\d+) cross page\), "
+                  r"(\d+) page checks failed", info)
+    report(m is not None, "info jit reports direct jumps")
+    if m:
+        links, cross_page, fails = (int(x) for x in m.groups())
+        report(links >= cross_page > 0,
+               "%d of %d linked jumps are cross page" % (cross_page, links))
+        report(fails > 0, "%d page checks failed" % (fails))
+
+    report(cbp.hit_count == 0, "didn't reach backstop")
+
+#
+# This runs as the script it sourced (via -x, via run-test.py)
+#
+try:
+    inferior = gdb.selected_inferior()
+    arch = inferior.architecture()
+    print("ATTACHED: %s" % arch.name())
+except (gdb.error, AttributeError):
+    print("SKIPPING (not connected)", file=sys.stderr)
+    exit(0)
+
+if gdb.parse_and_eval('$pc') == 0:
+    print("SKIP: PC not set")
+    exit(0)
+
+try:
+    # These are not very useful in scripts
+    gdb.execute("set pagination off")
+
+    # Run the actual tests
+    run_test()
+except (gdb.error):
+    print("GDB Exception: %s" % (sys.exc_info()[0]))
+    failcount += 1
+    pass
+
+# Finally kill the inferior and exit gdb with a count of failures
+gdb.execute("kill")
+exit(failcount)
@@ -0,0 +1,92 @@
+/*
+ * Guest registers across chained TBs
+ *
+ * Each sequence copies a guest register into another one, changes the
+ * copy and ends the TB with a direct jump.  The next TB then checks that
+ * the source register still holds its value.  With -accel
+ * tcg,cached-regs=n, the copy may be given the host register that
+ * carries the source between TBs, which must not leak into the next TB.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define LOOPS 1000
+
+/* rdx = rax + 1 */
+static uint64_t copy_inc(uint64_t a, uint64_t *copy)
+{
+    uint64_t out, d;
+
+    asm volatile("jmp 1f\n"
+                 "1: mov %%rax, %%rdx\n"
+                 "inc %%rdx\n"
+                 "jmp 2f\n"
+                 "2: mov %%rax, %0\n"
+                 : "=&r"(out), "=&d"(d) : "a"(a) : "cc");
+    *copy = d;
+    return out;
+}
+
+/* rcx = rax + 5, as an in-place add */
+static uint64_t copy_add(uint64_t a, uint64_t *copy)
+{
+    uint64_t out, c;
+
+    asm volatile("jmp 1f\n"
+                 "1: mov %%rax, %%rcx\n"
+                 "add $5, %%rcx\n"
+                 "jmp 2f\n"
+                 "2: mov %%rax, %0\n"
+                 : "=&r"(out), "=&c"(c) : "a"(a) : "cc");
+    *copy = c;
+    return out;
+}
+
+/* rax = rdx << 3, with a conditional exit in between */
+static uint64_t copy_shift(uint64_t a, uint64_t *copy)
+{
+    uint64_t out, r;
+
+    asm volatile("jmp 1f\n"
+                 "1: mov %%rdx, %%rax\n"
+                 "shl $3, %%rax\n"
+                 "test %%rdx, %%rdx\n"
+                 "jnz 2f\n"
+                 "nop\n"
+                 "2: mov %%rdx, %0\n"
+                 : "=&r"(out), "=&a"(r) : "d"(a) : "cc");
+    *copy = r;
+    return out;
+}
+
+int main(void)
+{
+    uint64_t a, copy;
+    int i, fails = 0;
+
+    for (i = 0; i < LOOPS; i++) {
+        a = 0x123456789ull * (i + 1);
+
+        if (copy_inc(a, &copy) != a || copy != a + 1) {
+            ml_printf("FAIL: copy_inc(%llx) = %llx\n", a, copy);
+            fails++;
+        }
+        if (copy_add(a, &copy) != a || copy != a + 5) {
+            ml_printf("FAIL: copy_add(%llx) = %llx\n", a, copy);
+            fails++;
+        }
+        if (copy_shift(a, &copy) != a || copy != a << 3) {
+            ml_printf("FAIL: copy_shift(%llx) = %llx\n", a, copy);
+            fails++;
+        }
+        if (fails) {
+            return 1;
+        }
+    }
+
+    ml_printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Direct jumps into a TB that spans two pages
+ *
+ * A loop starts with an instruction that straddles the end of a page,
+ * so the TB of its first block spans two pages.  That TB is entered with
+ * a direct jump from a block on the first page, and chains to the rest of
+ * the loop on the second page.  Between runs, the guest maps another
+ * page, where the immediate of the straddling instruction differs, at the
+ * address of the second page.  The jump linked into the TB for the old
+ * mapping must not be followed after the remap; the TB checks its second
+ * page when it is entered.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define PAGE_SIZE 4096
+#define WINDOW 0x40000000ull    /* start of the second GB */
+#define LOOP_OFS (PAGE_SIZE - 8)
+#define ENTRY_OFS (PAGE_SIZE - 256)
+#define LOOPS 1000
+#define ROUNDS 8
+
+#define PTE_FLAGS 7             /* present, writable, user */
+
+static uint8_t page0[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static uint8_t page1[2][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t pt[512] __attribute__((aligned(PAGE_SIZE)));
+
+static uint64_t *next_table(uint64_t entry)
+{
+    return (uint64_t *)(uintptr_t)(entry & ~0xfffull);
+}
+
+/* Map the first 2 MiB of WINDOW with 4 KiB pages, in pt */
+static void map_window(void)
+{
+    uint64_t cr3, *pdp, *pd;
+
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    pdp = next_table(next_table(cr3)[0]);
+    pd = next_table(pdp[WINDOW >> 30]);
+
+    pt[0] = (uintptr_t)page0 | PTE_FLAGS;
+    pt[1] = (uintptr_t)page1[0] | PTE_FLAGS;
+    pd[0] = (uintptr_t)pt | PTE_FLAGS;
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+static void remap_page1(int which)
+{
+    pt[1] = (uintptr_t)page1[which] | PTE_FLAGS;
+    asm volatile("invlpg (%0)" : : "r"(WINDOW + PAGE_SIZE) : "memory");
+}
+
+/*
+ * page0, at ENTRY_OFS:  jmp loop
+ *        at LOOP_OFS:   loop: add $1, %eax; add $((i + 1) << 8), %edx
+ * page1[i]:             (last 3 bytes of the add); dec %ecx; jnz loop; ret
+ */
+static void write_code(void)
+{
+    uint8_t *p = page0 + ENTRY_OFS;
+    int32_t rel;
+    int i, j;
+
+    rel = LOOP_OFS - (ENTRY_OFS + 5);
+    *p++ = 0xe9;
+    for (j = 0; j < 4; j++) {
+        *p++ = rel >> (j * 8);
+    }
+
+    p = page0 + LOOP_OFS;
+    *p++ = 0x05;
+    *p++ = 1;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0x81;
+    *p++ = 0xc2;
+    *p++ = 0;
+
+    for (i = 0; i < 2; i++) {
+        p = page1[i];
+        *p++ = i + 1;
+        *p++ = 0;
+        *p++ = 0;
+        *p++ = 0xff;
+        *p++ = 0xc9;
+        rel = LOOP_OFS - (PAGE_SIZE + 7);
+        *p++ = 0x75;
+        *p++ = rel;
+        *p++ = 0xc3;
+    }
+}
+
+static uint32_t run_loop(uint32_t count)
+{
+    uint32_t sum = 0, iters = 0;
+
+    /* Step over the red zone, which the compiler may use here */
+    asm volatile("sub $128, %%rsp\n"
+                 "call *%3\n"
+                 "add $128, %%rsp\n"
+                 : "+d"(sum), "+a"(iters), "+c"(count)
+                 : "r"(WINDOW + ENTRY_OFS)
+                 : "cc", "memory");
+    if (iters != LOOPS) {
+        ml_printf("FAIL: loop ran %d times\n", iters);
+        return 0;
+    }
+    return sum;
+}
+
+/* The gdbstub test stops here to look at the counters of info jit */
+void loops_done(void)
+{
+}
+
+int main(void)
+{
+    uint32_t sum;
+    int i;
+
+    write_code();
+    map_window();
+
+    for (i = 0; i < ROUNDS; i++) {
+        remap_page1(i & 1);
+        sum = run_loop(LOOPS);
+        if (sum != LOOPS * (((i & 1) + 1) << 8)) {
+            ml_printf("FAIL: round %d: sum %d, expected %d\n",
+                      i, sum, LOOPS * (((i & 1) + 1) << 8));
+            return 1;
+        }
+    }
+    loops_done();
+
+    ml_printf("PASS\n");
+    return 0;
+}
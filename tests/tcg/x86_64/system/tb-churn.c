@@ -0,0 +1,79 @@
+/*
+ * Translate more code than the translation buffer holds
+ *
+ * The guest writes a long chain of small blocks, each of which adds a
+ * constant to eax and jumps to the next one, and runs it several times.
+ * With a small -accel tcg,tb-size=n, the translation buffer fills up
+ * again and again, so old regions are recycled, or the whole buffer is
+ * flushed when it has a single region, while direct jumps between the
+ * blocks are linked and must be unlinked when their destination goes.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define CODE_SIZE (1 << 20)
+#define BLOCK_SIZE 7            /* add $imm32, %eax; jmp .+2 */
+#define BLOCKS ((CODE_SIZE - 1) / BLOCK_SIZE)
+#define PASSES 4
+
+static uint8_t code[CODE_SIZE] __attribute__((aligned(4096)));
+
+static uint32_t block_imm(unsigned i)
+{
+    return i * 7 + 1;
+}
+
+static void write_code(void)
+{
+    uint8_t *p = code;
+    unsigned i;
+
+    for (i = 0; i < BLOCKS; i++) {
+        uint32_t imm = block_imm(i);
+
+        *p++ = 0x05;            /* add $imm32, %eax */
+        *p++ = imm;
+        *p++ = imm >> 8;
+        *p++ = imm >> 16;
+        *p++ = imm >> 24;
+        *p++ = 0xeb;            /* jmp .+2 */
+        *p++ = 0x00;
+    }
+    *p = 0xc3;                  /* ret */
+}
+
+static uint32_t run_code(uint32_t a)
+{
+    /* Step over the red zone, which the compiler may use here */
+    asm volatile("sub $128, %%rsp\n"
+                 "call *%1\n"
+                 "add $128, %%rsp\n"
+                 : "+a"(a) : "r"(code) : "cc", "memory");
+    return a;
+}
+
+int main(void)
+{
+    uint32_t expected = 0, a;
+    unsigned i;
+
+    write_code();
+    for (i = 0; i < BLOCKS; i++) {
+        expected += block_imm(i);
+    }
+
+    for (i = 0; i < PASSES; i++) {
+        a = run_code(i);
+        if (a != expected + i) {
+            ml_printf("FAIL: pass %d: %x, expected %x\n",
+                      i, a, expected + i);
+            return 1;
+        }
+    }
+
+    ml_printf("PASS\n");
+    return 0;
+}
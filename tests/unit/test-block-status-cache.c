@@ -0,0 +1,166 @@
+/*
+ * Block-status cache tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "block/block_int.h"
+
+/* Check that [offset, offset + bytes) is cached as one data region */
+static void assert_data(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    int64_t pnum = -1;
+
+    g_assert_true(bdrv_bsc_is_data(bs, offset, &pnum));
+    g_assert_cmpint(pnum, ==, bytes);
+}
+
+static void assert_no_data(BlockDriverState *bs, int64_t offset)
+{
+    int64_t pnum = -1;
+
+    g_assert_false(bdrv_bsc_is_data(bs, offset, &pnum));
+    g_assert_cmpint(pnum, ==, -1);
+}
+
+static void test_fill_merge(void)
+{
+    BlockDriverState *bs = bdrv_new();
+
+    bdrv_bsc_fill(bs, 4096, 4096);
+    assert_no_data(bs, 0);
+    assert_data(bs, 4096, 4096);
+    assert_data(bs, 6144, 2048);
+    assert_no_data(bs, 8192);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 1);
+
+    /* Adjacent regions are merged, on both sides */
+    bdrv_bsc_fill(bs, 8192, 4096);
+    bdrv_bsc_fill(bs, 0, 4096);
+    assert_data(bs, 0, 12288);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 1);
+
+    /* A separate region stays separate */
+    bdrv_bsc_fill(bs, 65536, 4096);
+    assert_no_data(bs, 12288);
+    assert_data(bs, 65536, 4096);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 2);
+
+    /* An overlapping region swallows both of them */
+    bdrv_bsc_fill(bs, 8192, 61440);
+    assert_data(bs, 0, 69632);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 1);
+
+    /* A region within a cached one changes nothing */
+    bdrv_bsc_fill(bs, 512, 512);
+    assert_data(bs, 0, 69632);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 1);
+
+    bdrv_unref(bs);
+}
+
+static void test_invalidate(void)
+{
+    BlockDriverState *bs = bdrv_new();
+
+    bdrv_bsc_fill(bs, 0, 65536);
+
+    /* Invalidating the middle splits the region */
+    bdrv_bsc_invalidate_range(bs, 16384, 4096);
+    assert_data(bs, 0, 16384);
+    assert_no_data(bs, 16384);
+    assert_no_data(bs, 20479);
+    assert_data(bs, 20480, 45056);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 2);
+
+    /* Cut the head and the tail off both regions */
+    bdrv_bsc_invalidate_range(bs, 8192, 16384);
+    assert_data(bs, 0, 8192);
+    assert_no_data(bs, 8192);
+    assert_data(bs, 24576, 40960);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 2);
+
+    /* Drop a whole region, and nothing outside of the range */
+    bdrv_bsc_invalidate_range(bs, 0, 8192);
+    assert_no_data(bs, 0);
+    assert_data(bs, 24576, 40960);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 1);
+
+    /* A range without any data is fine */
+    bdrv_bsc_invalidate_range(bs, 0, 16384);
+    assert_data(bs, 24576, 40960);
+
+    bdrv_unref(bs);
+}
+
+static void test_truncate(void)
+{
+    BlockDriverState *bs = bdrv_new();
+
+    bdrv_bsc_fill(bs, 0, 4096);
+    bdrv_bsc_fill(bs, 16384, 16384);
+    bdrv_bsc_fill(bs, 65536, 4096);
+
+    /* Shrinking drops everything past the new end, as bdrv_co_truncate() */
+    bdrv_bsc_invalidate_range(bs, 20480, INT64_MAX - 20480);
+    assert_data(bs, 0, 4096);
+    assert_data(bs, 16384, 4096);
+    assert_no_data(bs, 20480);
+    assert_no_data(bs, 65536);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==, 2);
+
+    bdrv_unref(bs);
+}
+
+static void test_lru_cap(void)
+{
+    BlockDriverState *bs = bdrv_new();
+    int64_t i;
+
+    /* Separate regions, each followed by a hole */
+    for (i = 0; i < BDRV_BSC_MAX_ENTRIES; i++) {
+        bdrv_bsc_fill(bs, i * 8192, 4096);
+    }
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==,
+                     BDRV_BSC_MAX_ENTRIES);
+
+    /* Use the first region, so the second one is the least recently used */
+    assert_data(bs, 0, 4096);
+
+    bdrv_bsc_fill(bs, BDRV_BSC_MAX_ENTRIES * 8192, 4096);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==,
+                     BDRV_BSC_MAX_ENTRIES);
+    assert_data(bs, 0, 4096);
+    assert_no_data(bs, 8192);
+    assert_data(bs, BDRV_BSC_MAX_ENTRIES * 8192, 4096);
+
+    /* A split at the limit evicts the least recently used region too */
+    bdrv_bsc_invalidate_range(bs, 1024, 1024);
+    g_assert_cmpuint(bs->block_status_cache->nr_entries, ==,
+                     BDRV_BSC_MAX_ENTRIES);
+    assert_data(bs, 0, 1024);
+    assert_data(bs, 2048, 2048);
+    assert_no_data(bs, 16384);
+    assert_data(bs, 24576, 4096);
+
+    bdrv_unref(bs);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/block-status-cache/fill-merge", test_fill_merge);
+    g_test_add_func("/block-status-cache/invalidate", test_invalidate);
+    g_test_add_func("/block-status-cache/truncate", test_truncate);
+    g_test_add_func("/block-status-cache/lru-cap", test_lru_cap);
+
+    return g_test_run();
+}
@@ -0,0 +1,77 @@
+/*
+ * Test the worker thread pool
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/work-pool.h"
+
+#define NR_ITEMS 1000
+
+static unsigned int counts[NR_ITEMS];
+
+static void count_item(void *opaque, unsigned int index)
+{
+    unsigned int *total = opaque;
+
+    qatomic_inc(&counts[index]);
+    qatomic_inc(total);
+}
+
+static void check_run(WorkPool *pool, unsigned int n)
+{
+    unsigned int total = 0;
+    unsigned int i;
+
+    memset(counts, 0, sizeof(counts));
+    work_pool_run(pool, count_item, &total, n);
+
+    g_assert_cmpuint(total, ==, n);
+    for (i = 0; i < NR_ITEMS; i++) {
+        g_assert_cmpuint(counts[i], ==, i < n ? 1 : 0);
+    }
+}
+
+static void test_no_pool(void)
+{
+    check_run(NULL, NR_ITEMS);
+    g_assert_cmpuint(work_pool_threads(NULL), ==, 0);
+}
+
+static void test_no_threads(void)
+{
+    WorkPool *pool = work_pool_new("test", 0);
+
+    g_assert_cmpuint(work_pool_threads(pool), ==, 0);
+    check_run(pool, NR_ITEMS);
+    work_pool_free(pool);
+}
+
+static void test_threads(void)
+{
+    WorkPool *pool = work_pool_new("test", 4);
+    unsigned int i;
+
+    g_assert_cmpuint(work_pool_threads(pool), ==, 4);
+    for (i = 0; i < 100; i++) {
+        check_run(pool, g_test_rand_int_range(0, NR_ITEMS + 1));
+    }
+    check_run(pool, 0);
+    check_run(pool, 1);
+    check_run(pool, NR_ITEMS);
+    work_pool_free(pool);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/work-pool/no-pool", test_no_pool);
+    g_test_add_func("/work-pool/no-threads", test_no_threads);
+    g_test_add_func("/work-pool/threads", test_threads);
+
+    return g_test_run();
+}
@@ -444,6 +444,6 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 }
 
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
-                                Error **errp)
+                                int64_t sqpoll_idle_ms, Error **errp)
 {
 }
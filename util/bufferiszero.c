@@ -237,6 +237,91 @@ buffer_zero_avx512(const void *buf, size_t len)
 # define INIT_ACCEL buffer_zero_sse2
 #endif
 
+#elif defined(__aarch64__)
+/* Advanced SIMD is part of the base AArch64 ISA, no runtime check needed. */
+#include <arm_neon.h>
+
+/* Note that each of these vectorized functions require len >= 64.  */
+
+static bool
+buffer_zero_neon(const void *buf, size_t len)
+{
+    uint64x2_t t = vreinterpretq_u64_u8(vld1q_u8(buf));
+    const uint64x2_t *p = (uint64x2_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint64x2_t *e = (uint64x2_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(vmaxvq_u32(vreinterpretq_u32_u64(t)))) {
+            return false;
+        }
+        t = vorrq_u64(vorrq_u64(p[-4], p[-3]), vorrq_u64(p[-2], p[-1]));
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t = vorrq_u64(t, e[-3]);
+    t = vorrq_u64(t, e[-2]);
+    t = vorrq_u64(t, e[-1]);
+
+    /* Finish the unaligned tail.  */
+    t = vorrq_u64(t, vreinterpretq_u64_u8(vld1q_u8(buf + len - 16)));
+
+    return vmaxvq_u32(vreinterpretq_u32_u64(t)) == 0;
+}
+
+#ifdef CONFIG_SVE_OPT
+#pragma GCC push_options
+#pragma GCC target("+sve")
+#include <arm_sve.h>
+
+static bool
+buffer_zero_sve(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const size_t vl = svcntb();
+    const svbool_t all = svptrue_b8();
+    size_t i;
+
+    /* Loop over blocks of 4 vectors, whatever the vector length.  */
+    for (i = 0; i + 4 * vl <= len; i += 4 * vl) {
+        svuint8_t t = svorr_u8_x(all, svld1_u8(all, p + i),
+                                 svld1_u8(all, p + i + vl));
+
+        t = svorr_u8_x(all, t, svld1_u8(all, p + i + 2 * vl));
+        t = svorr_u8_x(all, t, svld1_u8(all, p + i + 3 * vl));
+        if (unlikely(svptest_any(all, svcmpne_n_u8(all, t, 0)))) {
+            return false;
+        }
+    }
+
+    /* Finish the tail with partial vectors.  */
+    for (; i < len; i += vl) {
+        svbool_t pg = svwhilelt_b8_u64(i, len);
+
+        if (svptest_any(pg, svcmpne_n_u8(pg, svld1_u8(pg, p + i), 0))) {
+            return false;
+        }
+    }
+    return true;
+}
+#pragma GCC pop_options
+#endif /* CONFIG_SVE_OPT */
+
+/* Note that for test_buffer_is_zero_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_SVE     1
+#define CACHE_NEON    2
+
+#define INIT_CACHE CACHE_NEON
+#define INIT_ACCEL buffer_zero_neon
+#endif
+
+#if defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT) || \
+    defined(__SSE2__) || defined(__aarch64__)
+
 static unsigned cpuid_cache = INIT_CACHE;
 static bool (*buffer_accel)(const void *, size_t) = INIT_ACCEL;
 static int length_to_accel = 64;
@@ -244,6 +329,18 @@ static int length_to_accel = 64;
 static void init_accel(unsigned cache)
 {
     bool (*fn)(const void *, size_t) = buffer_zero_int;
+#ifdef __aarch64__
+    if (cache & CACHE_NEON) {
+        fn = buffer_zero_neon;
+        length_to_accel = 64;
+    }
+#ifdef CONFIG_SVE_OPT
+    if (cache & CACHE_SVE) {
+        fn = buffer_zero_sve;
+        length_to_accel = 64;
+    }
+#endif
+#else
     if (cache & CACHE_SSE2) {
         fn = buffer_zero_sse2;
         length_to_accel = 64;
@@ -264,6 +361,7 @@ static void init_accel(unsigned cache)
         length_to_accel = 256;
     }
 #endif
+#endif /* !__aarch64__ */
     buffer_accel = fn;
 }
 
@@ -308,6 +406,25 @@ static void __attribute__((constructor)) init_cpuid_cache(void)
 }
 #endif /* CONFIG_AVX2_OPT */
 
+#ifdef CONFIG_SVE_OPT
+#include "elf.h"
+
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned cache = CACHE_NEON;
+
+    if (qemu_getauxval(AT_HWCAP) & HWCAP_SVE) {
+        cache |= CACHE_SVE;
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_SVE_OPT */
+
 bool test_buffer_is_zero_next_accel(void)
 {
     /* If no bits set, we just tested buffer_zero_int, and there
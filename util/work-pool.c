@@ -0,0 +1,173 @@
+/*
+ * Pool of worker threads for data-parallel loops
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/work-pool.h"
+
+struct WorkPool {
+    unsigned int nthreads;
+    QemuThread *threads;
+
+    /* Protects all fields below, except @next */
+    QemuMutex lock;
+    /* Signalled when a new run starts or the pool is freed */
+    QemuCond work_cond;
+    /* Signalled when the last busy worker goes idle */
+    QemuCond idle_cond;
+    /* Incremented for every work_pool_run() */
+    uint64_t generation;
+    /* Workers that have picked up the current run and are not done yet */
+    unsigned int busy;
+    bool quit;
+
+    WorkPoolFunc *func;
+    void *opaque;
+    unsigned int n;
+    /* Next index to hand out, accessed atomically */
+    unsigned int next;
+};
+
+static void work_pool_do_work(WorkPool *pool, WorkPoolFunc *func,
+                              void *opaque, unsigned int n)
+{
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&pool->next)) < n) {
+        func(opaque, i);
+    }
+}
+
+static void *work_pool_thread(void *opaque)
+{
+    WorkPool *pool = opaque;
+    uint64_t generation = 0;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&pool->lock);
+    while (true) {
+        WorkPoolFunc *func;
+        void *func_opaque;
+        unsigned int n;
+
+        while (!pool->quit && pool->generation == generation) {
+            qemu_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+
+        generation = pool->generation;
+        func = pool->func;
+        func_opaque = pool->opaque;
+        n = pool->n;
+        pool->busy++;
+        qemu_mutex_unlock(&pool->lock);
+
+        work_pool_do_work(pool, func, func_opaque, n);
+
+        qemu_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            qemu_cond_signal(&pool->idle_cond);
+        }
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+WorkPool *work_pool_new(const char *name, unsigned int threads)
+{
+    WorkPool *pool = g_new0(WorkPool, 1);
+    unsigned int i;
+
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->work_cond);
+    qemu_cond_init(&pool->idle_cond);
+
+    pool->nthreads = threads;
+    pool->threads = g_new0(QemuThread, threads);
+    for (i = 0; i < threads; i++) {
+        g_autofree char *thread_name = g_strdup_printf("%s/%u", name, i);
+
+        qemu_thread_create(&pool->threads[i], thread_name, work_pool_thread,
+                           pool, QEMU_THREAD_JOINABLE);
+    }
+
+    return pool;
+}
+
+void work_pool_free(WorkPool *pool)
+{
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    pool->quit = true;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthreads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+
+    qemu_cond_destroy(&pool->idle_cond);
+    qemu_cond_destroy(&pool->work_cond);
+    qemu_mutex_destroy(&pool->lock);
+    g_free(pool->threads);
+    g_free(pool);
+}
+
+unsigned int work_pool_threads(WorkPool *pool)
+{
+    return pool ? pool->nthreads : 0;
+}
+
+void work_pool_run(WorkPool *pool, WorkPoolFunc *func, void *opaque,
+                   unsigned int n)
+{
+    unsigned int i;
+
+    if (!pool || !pool->nthreads || n <= 1) {
+        for (i = 0; i < n; i++) {
+            func(opaque, i);
+        }
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    /*
+     * A worker that woke up too late for the previous run may still be
+     * looking for indexes of it; let it find none before resetting @next.
+     */
+    while (pool->busy) {
+        qemu_cond_wait(&pool->idle_cond, &pool->lock);
+    }
+    pool->func = func;
+    pool->opaque = opaque;
+    pool->n = n;
+    qatomic_set(&pool->next, 0);
+    pool->generation++;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    work_pool_do_work(pool, func, opaque, n);
+
+    /* Every index has been handed out, wait for those still running */
+    qemu_mutex_lock(&pool->lock);
+    while (pool->busy) {
+        qemu_cond_wait(&pool->idle_cond, &pool->lock);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}